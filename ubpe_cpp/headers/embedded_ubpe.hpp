@@ -0,0 +1,346 @@
+#ifndef EMBEDDED_UBPE_CPP
+#define EMBEDDED_UBPE_CPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "counter.hpp"
+#include "embedding.hpp"
+#include "token_counts.hpp"
+#include "utils.hpp"
+
+namespace ubpe {
+
+/// Read-only tokenizer over the tables of an embedded model, e.g. of a header
+/// made by `embed` and compiled into the binary, so it needs no loading.
+///
+/// Note: documents are encoded the same as by the tokenizer with a single
+/// encoding; the search of `Ubpe` models is chosen as for the tokenizer.
+/// Unknown symbols and tokens are errors, as with `UnknownPolicy::RAISE`.
+template <DocumentT DocType, typename TokenType = typename DocType::value_type>
+class EmbeddedUbpe {
+   private:
+    using Model = EmbeddedModel<TokenType>;
+
+    Model model;
+
+    /// @brief Get the weight of `token`.
+    double _token_weight(std::uint32_t token) const {
+        return token < this->model.weights.size() ? this->model.weights[token]
+                                                  : 0.0;
+    }
+
+    /// @brief Get the rank of a pair of tokens, or `Model::NONE` if the pair
+    /// is not substituted.
+    std::uint32_t _rank(std::uint32_t first, std::uint32_t second) const {
+        const auto& keys = this->model.pair_keys;
+        auto key = Model::pack(first, second);
+        auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        if (it == keys.end() || *it != key) return Model::NONE;
+        return this->model.pair_ranks[it - keys.begin()];
+    }
+
+    /// @brief Get the first rank after `rank` of a pair that contains
+    /// `token`, or the number of pairs if there is no such pair.
+    std::size_t _next_occurrence(std::uint32_t token, std::size_t rank) const {
+        const auto& offsets = this->model.occurrence_offsets;
+        auto first = this->model.occurrence_ranks.begin() + offsets[token];
+        auto last = this->model.occurrence_ranks.begin() + offsets[token + 1];
+        auto it = std::upper_bound(first, last, rank);
+        return it == last ? this->model.merged.size() : *it;
+    }
+
+    /// @brief Replace pairs of adjacent tokens in `word` by `sub`, which maps
+    /// first tokens of pairs to the second tokens and the substitutes.
+    static void _replace_pairs(
+        std::vector<std::uint32_t>& word,
+        const std::unordered_map<
+            std::uint32_t, std::pair<std::uint32_t, std::uint32_t>>& sub) {
+        std::size_t left = 0, right = 0;
+        while (right + 1 < word.size()) {
+            auto it = sub.find(word[right]);
+            if (it != sub.end() && word[right + 1] == it->second.first) {
+                word[left++] = it->second.second;
+                right += 2;
+            } else {
+                word[left++] = word[right++];
+            }
+        }
+        if (right < word.size()) word[left++] = word[right++];
+        word.resize(left);
+    }
+
+    /// @brief Substitute pairs of tokens in `word` as `UbpeClassic` does in
+    /// one step.
+    /// @return `false` if no pair can be substituted.
+    bool _merge_step(std::vector<std::uint32_t>& word,
+                     std::vector<std::uint32_t>& present) const {
+        if (word.size() < 2) return false;
+
+        present.clear();
+        for (std::size_t i = 0; i + 1 < word.size(); i++) {
+            auto rank = this->_rank(word[i], word[i + 1]);
+            if (rank != Model::NONE) present.emplace_back(rank);
+        }
+        if (present.empty()) return false;
+        std::sort(present.begin(), present.end());
+        present.erase(std::unique(present.begin(), present.end()),
+                      present.end());
+
+        // pairs are taken in order of their ranks until the first pair that
+        // shares a token with the taken ones
+        std::unordered_map<std::uint32_t,
+                           std::pair<std::uint32_t, std::uint32_t>>
+            sub;
+        std::size_t limit = this->model.merged.size();
+        for (const auto& rank : present) {
+            if (rank >= limit) break;
+            auto first = this->model.pairs[2 * rank];
+            auto second = this->model.pairs[2 * rank + 1];
+            sub[first] = {second, this->model.merged[rank]};
+            limit = std::min({limit, this->_next_occurrence(first, rank),
+                              this->_next_occurrence(second, rank)});
+        }
+
+        _replace_pairs(word, sub);
+        return true;
+    }
+
+    /// @brief Encode a word as `UbpeClassic` does.
+    std::pair<std::vector<std::uint32_t>, double> _encode_classic(
+        std::vector<std::uint32_t> word) const {
+        std::vector<std::uint32_t> present;
+        while (this->_merge_step(word, present)) {
+        }
+
+        auto counter = Counter<std::uint32_t>(word);
+        auto weight = std::accumulate(
+            counter.cbegin(), counter.cend(), 0.0,
+            [this](double total, auto& element) {
+                double freq = element.second;
+                return total + (1.0 + std::log(freq)) *
+                                   this->_token_weight(element.first);
+            });
+        return {std::move(word), weight};
+    }
+
+    /// @brief Encode a word by taking the longest token at each position, as
+    /// `Ubpe` does with `EncodeMode::GREEDY`.
+    std::pair<std::vector<std::uint32_t>, double> _encode_greedy(
+        const std::vector<std::uint32_t>& word) const {
+        const auto& offsets = this->model.trie_offsets;
+        const auto& symbols = this->model.trie_symbols;
+        std::vector<std::uint32_t> tokens;
+        tokens.reserve(word.size());
+        for (std::size_t start = 0; start < word.size();) {
+            std::size_t length = 0;
+            std::uint32_t token = Model::NONE;
+            std::uint32_t state = 0;
+            for (std::size_t i = start; i < word.size(); i++) {
+                auto first = symbols.begin() + offsets[state];
+                auto last = symbols.begin() + offsets[state + 1];
+                auto it = std::lower_bound(first, last, word[i]);
+                if (it == last || *it != word[i]) break;
+                state = this->model.trie_targets[it - symbols.begin()];
+                if (this->model.trie_values[state] != Model::NONE) {
+                    length = i + 1 - start;
+                    token = this->model.trie_values[state];
+                }
+            }
+            if (length == 0)
+                throw std::invalid_argument("Unknown token in the word");
+            tokens.emplace_back(token);
+            start += length;
+        }
+
+        // counts of tokens are lengths of runs of equal tokens after sorting
+        auto sorted_tokens = tokens;
+        std::sort(sorted_tokens.begin(), sorted_tokens.end());
+        double weight = 0.0;
+        for (std::size_t i = 0; i < sorted_tokens.size();) {
+            std::size_t j = i + 1;
+            while (j < sorted_tokens.size() &&
+                   sorted_tokens[j] == sorted_tokens[i])
+                j++;
+            weight += (1.0 + std::log(static_cast<double>(j - i))) *
+                      this->_token_weight(sorted_tokens[i]);
+            i = j;
+        }
+        return {std::move(tokens), weight};
+    }
+
+    /// @brief Find the best encoding of a word, as `Ubpe` does with
+    /// `EncodeMode::LATTICE`.
+    ///
+    /// Note: the best tail is selected for each start from the end of the
+    /// word among the tokens found by the trie from the start, which are
+    /// found in order of increasing length; ties are resolved as by the
+    /// tokenizer: the tail with fewer tokens, then the shorter first token
+    /// wins.
+    std::pair<std::vector<std::uint32_t>, double> _encode_lattice(
+        const std::vector<std::uint32_t>& word) const {
+        struct Tail {
+            double weight = 0.0;
+            std::size_t length = 0;
+            std::uint32_t token = 0;
+            std::size_t span = 0;
+            TokenCounts<std::uint32_t> counter{};
+        };
+
+        const auto& offsets = this->model.trie_offsets;
+        const auto& symbols = this->model.trie_symbols;
+        std::vector<Tail> tails(word.size() + 1);
+        for (std::size_t start = word.size(); start-- > 0;) {
+            std::optional<Tail> best = std::nullopt;
+            std::uint32_t state = 0;
+            for (std::size_t i = start; i < word.size(); i++) {
+                auto first = symbols.begin() + offsets[state];
+                auto last = symbols.begin() + offsets[state + 1];
+                auto it = std::lower_bound(first, last, word[i]);
+                if (it == last || *it != word[i]) break;
+                state = this->model.trie_targets[it - symbols.begin()];
+                auto token = this->model.trie_values[state];
+                if (token == Model::NONE) continue;
+
+                const auto& tail = tails[i + 1];
+                auto counter = tail.counter;
+                counter.increment(token);
+                // the same sum in the same order as of the tokenizer
+                auto weight = std::accumulate(
+                    counter.cbegin(), counter.cend(), 0.0,
+                    [this](double total, const auto& element) {
+                        double freq = element.second;
+                        return total + (1.0 + std::log(freq)) *
+                                           this->_token_weight(element.first);
+                    });
+                auto length = tail.length + 1;
+                if (!best.has_value() || best->weight < weight ||
+                    (best->weight == weight && best->length > length))
+                    best = Tail{weight, length, token, i + 1 - start,
+                                std::move(counter)};
+            }
+            if (!best.has_value())
+                throw std::invalid_argument("Unknown token in a word");
+            tails[start] = std::move(best.value());
+        }
+
+        // restore the sequence
+        std::vector<std::uint32_t> tokens;
+        tokens.reserve(tails[0].length);
+        for (std::size_t start = 0; start < word.size();
+             start += tails[start].span) {
+            tokens.emplace_back(tails[start].token);
+        }
+        return {std::move(tokens), tails[0].weight};
+    }
+
+    /// @brief Encode a word with the search of the model's class.
+    std::pair<std::vector<std::uint32_t>, double> _encode_word(
+        const std::vector<std::uint32_t>& word, EncodeMode encode_mode) const {
+        if (this->model.is_classic) return this->_encode_classic(word);
+        return encode_mode == EncodeMode::GREEDY ? this->_encode_greedy(word)
+                                                 : this->_encode_lattice(word);
+    }
+
+   public:
+    /// @brief Constructor.
+    /// @param model Tables of a fitted tokenizer, e.g. `model` of a header
+    /// made by `embed`.
+    constexpr EmbeddedUbpe(const EmbeddedModel<TokenType>& model)
+        : model(model) {}
+
+    EmbeddedUbpe(const EmbeddedUbpe&) = default;
+    EmbeddedUbpe(EmbeddedUbpe&&) = default;
+    EmbeddedUbpe& operator=(const EmbeddedUbpe&) = default;
+    EmbeddedUbpe& operator=(EmbeddedUbpe&&) = default;
+    ~EmbeddedUbpe() = default;
+
+    /// @brief Encode a document.
+    /// @param doc Document to encode.
+    /// @param encode_mode Search used to encode words of `Ubpe` models;
+    /// `EncodeMode::LATTICE_F32` searches in double precision, as
+    /// `EncodeMode::LATTICE`.
+    /// @return List with the encoded document and its weight, or an empty
+    /// list for an empty document, the same as of the tokenizer.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
+        const DocType& doc,
+        EncodeMode encode_mode = EncodeMode::LATTICE) const {
+        // handle empty sequence
+        if (doc.size() == 0) return {};
+
+        std::vector<std::uint32_t> tokens;
+        tokens.reserve(doc.size());
+        const auto& symbols = this->model.sorted_symbols;
+        for (const auto& symbol : doc) {
+            auto it = std::lower_bound(symbols.begin(), symbols.end(), symbol);
+            if (it == symbols.end() || *it != symbol)
+                throw std::out_of_range("Unknown symbol");
+            tokens.emplace_back(
+                this->model.sorted_indices[it - symbols.begin()]);
+        }
+        return this->encode(std::vector<std::vector<std::uint32_t>>{tokens},
+                            encode_mode);
+    }
+
+    /// @brief Encode a document split into words of basic tokens.
+    /// @param parts Words of the document.
+    /// @param encode_mode Search used to encode words of `Ubpe` models.
+    /// @return List with the encoded document and its weight.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
+        const std::vector<std::vector<std::uint32_t>>& parts,
+        EncodeMode encode_mode = EncodeMode::LATTICE) const {
+        // handle empty sequence
+        if (parts.empty()) return {{{}, 0.0}};
+        if (parts.size() == 1)
+            return {this->_encode_word(parts[0], encode_mode)};
+
+        std::vector<std::uint32_t> result;
+        double weight = 0.0;
+        for (const auto& word : parts) {
+            // basic tokens that are words by themselves have no weight
+            if (word.size() == 1) {
+                result.emplace_back(word[0]);
+                continue;
+            }
+            auto [encoded, word_weight] = this->_encode_word(word, encode_mode);
+            result.insert(result.end(), encoded.begin(), encoded.end());
+            weight += word_weight;
+        }
+        return {{result, weight}};
+    }
+
+    /// @brief Decode tokens to a document.
+    /// @param tokens Tokens to decode.
+    /// @return Decoded document.
+    DocType decode(const std::vector<std::uint32_t>& tokens) const {
+        const auto& offsets = this->model.expansion_offsets;
+        DocType doc;
+        doc.reserve(tokens.size());
+        for (const auto& token : tokens) {
+            if (token + std::size_t(1) < offsets.size() &&
+                offsets[token] != offsets[token + 1]) {
+                for (auto i = offsets[token]; i < offsets[token + 1]; i++) {
+                    doc.emplace_back(
+                        this->model.symbols[this->model.expansions[i]]);
+                }
+            } else if (token < this->model.symbols.size()) {
+                doc.emplace_back(this->model.symbols[token]);
+            } else {
+                throw std::out_of_range("Unknown token");
+            }
+        }
+        return doc;
+    }
+};
+
+}  // namespace ubpe
+
+#endif  // EMBEDDED_UBPE_CPP
@@ -2,18 +2,22 @@
 #define UBPE_CPP
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <limits>
 #include <numeric>
 #include <optional>
-#include <stack>
 #include <stdexcept>
+#include <unordered_map>
 
-#include "counter.hpp"
+#include "aho_corasick.hpp"
 #include "logger.hpp"
+#include "merge_history.hpp"
 #include "pair_counter.hpp"
-#include "ssstree.hpp"
+#include "token_counts.hpp"
 #include "top_elements.hpp"
 #include "ubpe_base.hpp"
 
@@ -24,12 +28,14 @@ namespace ubpe {
 struct EncodingCandidate {
     double weight;
     std::vector<std::uint32_t> sequence;
-    Counter<std::uint32_t> counter;
+    TokenCounts<std::uint32_t> counter;
 
     EncodingCandidate() = default;
     EncodingCandidate(double weight, std::vector<std::uint32_t> sequence,
-                      Counter<std::uint32_t> counter)
-        : weight(weight), sequence(sequence), counter(counter) {}
+                      TokenCounts<std::uint32_t> counter)
+        : weight(weight),
+          sequence(std::move(sequence)),
+          counter(std::move(counter)) {}
     EncodingCandidate(const EncodingCandidate&) = default;
     EncodingCandidate(EncodingCandidate&&) = default;
     EncodingCandidate& operator=(const EncodingCandidate&) = default;
@@ -73,184 +79,734 @@ bool operator>(const EncodingCandidate& lhs, const EncodingCandidate& rhs) {
     return lhs.weight > rhs.weight;
 }
 
+/// @brief Parameters of the approximate (beam-pruned) encoding.
+struct BeamConfig {
+    /// Maximum number of candidate tails kept at each position of a word,
+    /// except for its start, where `top_n` candidates are kept.
+    std::size_t width = 4;
+    /// Candidate tails that are lighter than the best one at the same
+    /// position by more than `margin` are dropped.
+    double margin = std::numeric_limits<double>::infinity();
+};
+
+/// @brief The best encoding of a suffix of a word; the encoding is restored
+/// by following `span` of the tails.
+struct BestTail {
+    double weight = 0.0;
+    /// Number of tokens in the encoding.
+    std::size_t length = 0;
+    /// The first token of the encoding.
+    std::uint32_t token = 0;
+    /// Number of basic tokens in the first token.
+    std::size_t span = 0;
+    TokenCounts<std::uint32_t> counter{};
+};
+
+/// @brief Memo of the encodings of suffixes of words, shared between words.
+///
+/// Weights of encodings of a suffix depend only on its own tokens, so the
+/// tails found for a suffix are the same in any word that ends with it, and
+/// words with common endings reuse them. Suffixes are stored in a trie of
+/// reversed words. Long suffixes are rarely shared, so only suffixes of up
+/// to `max_length` basic tokens are stored.
+///
+/// Note: a memo is valid only for the tokenizer and `top_n` it is used with,
+/// and is not used by the approximate search.
+class SuffixMemo {
+   public:
+    /// @brief Memoized tails of a suffix.
+    struct Entry {
+        std::optional<BestTail> best = std::nullopt;
+        std::optional<std::vector<EncodingCandidate>> candidates = std::nullopt;
+    };
+
+    /// Node of the empty suffix.
+    static constexpr std::uint32_t ROOT = 0;
+
+   private:
+    std::uint8_t top_n;
+    std::size_t max_length;
+    std::size_t max_size;
+    // references to entries must stay valid while new ones are added
+    std::deque<Entry> entries = std::deque<Entry>(1);
+    std::unordered_map<std::pair<std::uint32_t, std::uint32_t>, std::uint32_t,
+                       PairHash<std::uint32_t>>
+        children;
+
+   public:
+    /// @brief Create an empty memo.
+    /// @param top_n Number of encodings the memo is used to find.
+    /// @param max_length Maximum length of stored suffixes.
+    /// @param max_size Number of suffixes after which the memo is cleared.
+    explicit SuffixMemo(std::uint8_t top_n = 1, std::size_t max_length = 32,
+                        std::size_t max_size = std::size_t(1) << 18)
+        : top_n(top_n), max_length(max_length), max_size(max_size) {}
+
+    SuffixMemo(const SuffixMemo&) = delete;
+    SuffixMemo(SuffixMemo&&) = default;
+    SuffixMemo& operator=(const SuffixMemo&) = delete;
+    SuffixMemo& operator=(SuffixMemo&&) = default;
+    ~SuffixMemo() = default;
+
+    /// @brief Number of encodings the memo is used to find.
+    std::uint8_t get_top_n() const { return this->top_n; }
+
+    /// @brief Maximum length of stored suffixes.
+    std::size_t get_max_length() const { return this->max_length; }
+
+    /// @brief Number of stored suffixes, including the empty one.
+    std::size_t size() const { return this->entries.size(); }
+
+    /// @brief Remove all the suffixes.
+    void clear() {
+        this->entries = std::deque<Entry>(1);
+        this->children.clear();
+    }
+
+    /// @brief Clear the memo if it is full; must not be called while nodes
+    /// of a word are in use.
+    void trim() {
+        if (this->entries.size() >= this->max_size) this->clear();
+    }
+
+    /// @brief Get the node of the suffix `token` + suffix of `node`, adding
+    /// it if needed.
+    std::uint32_t child(std::uint32_t node, std::uint32_t token) {
+        auto [it, is_new] = this->children.try_emplace(
+            {node, token}, static_cast<std::uint32_t>(this->entries.size()));
+        if (is_new) this->entries.emplace_back();
+        return it->second;
+    }
+
+    /// @brief Get memoized tails of the suffix of `node`.
+    Entry& at(std::uint32_t node) { return this->entries.at(node); }
+};
+
 /// Universal Byte-Pair Encoding, that provides many options of encodings for
 /// the document.
 template <DocumentT DocType, typename TokenType = typename DocType::value_type>
 class Ubpe : public UbpeBase<DocType, TokenType> {
    private:
-    SSSTree<std::vector<std::uint32_t>, std::uint32_t> lookup;
+    mutable AhoCorasick<std::uint32_t> lookup;
+    /// Upper bound on the increase of weight of an encoding when a token is
+    /// added to it, indexed by tokens.
+    mutable std::vector<double> weight_bounds;
+    /// Weights of tokens in single precision, indexed by tokens.
+    mutable std::vector<float> dense_weights;
+    /// Weights of tokens in double precision, indexed by tokens.
+    mutable std::vector<double> exact_weights;
+
+    /// For each start in a word, tokens that start there paired with the
+    /// starts of the following tokens, in order of increasing length.
+    using Lattice =
+        std::vector<std::vector<std::pair<std::uint32_t, std::size_t>>>;
+
+    /// @brief Build the automaton that finds all tokens inside words, and
+    /// bounds of tokens' weights used to prune the search.
+    void _build_lookup() const {
+        this->lookup = {};
+        // inverse mappers may not be built yet, see `_build_cache`
+        for (const auto& [token, index] : this->alphabet) {
+            this->lookup.insert({index}, token);
+        }
+        for (const auto& [index, tokens] : this->tokens_backward_mapper) {
+            this->lookup.insert(tokens, index);
+        }
+        this->lookup.build();
+
+        // a token with count `c` adds `w * (1 + log(c))` to the weight, so
+        // one more occurrence adds `w` for `c = 0` and `w * log(1 + 1/c)`,
+        // which is less than `w`, otherwise
+        this->weight_bounds.clear();
+        this->dense_weights.clear();
+        this->exact_weights.clear();
+        for (const auto& [token, weight] : this->tokens_weights) {
+            if (token >= this->weight_bounds.size()) {
+                this->weight_bounds.resize(token + 1, 0.0);
+                this->dense_weights.resize(token + 1, 0.0f);
+                this->exact_weights.resize(token + 1, 0.0);
+            }
+            this->weight_bounds[token] = std::max(weight, 0.0);
+            this->dense_weights[token] = static_cast<float>(weight);
+            this->exact_weights[token] = weight;
+        }
+    }
 
-    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode_word(
-        std::vector<std::uint32_t> word,
-        std::uint8_t top_n = 1) const override {
-        // build initial stack
-        std::stack<std::pair<
-            std::size_t, std::vector<std::pair<std::size_t, std::uint32_t>>>>
-            stacks;
-        // from start
-        std::size_t start = 0;
-        // while the while `doc` is being searched in
-        while (start < word.size()) {
-            // try to find all key-value pairs in lookup tree where keys are
-            // subsequences from `start` in `doc`, i.e. basic tokens' sequences
-            // from `start` in `doc`
-            std::vector<std::pair<std::size_t, std::uint32_t>> stack =
-                this->lookup(word, start, true);
-            // place start-stack pair in `stacks`
-            stacks.emplace(std::make_pair(start, stack));
-            // next search will start after the longest key found
-            start += stack.back().first;
+    void _build_cache() const override { this->_build_lookup(); }
+
+    /// @brief Make tokens from `history` and cache lookup for encoding.
+    void _fit_merges(const MergeHistory& history, bool rearrange_tokens,
+                     Logger& logger) {
+        this->_apply_merges(history, false, rearrange_tokens, logger);
+
+        // cache lookup of tokens for encoding
+        this->_build_lookup();
+        logger.info("Built the lookup automaton");
+    }
+
+    /// @brief Build the lattice of a word.
+    Lattice _build_lattice(const std::vector<std::uint32_t>& word) const {
+        // all the tokens are found with a single pass, and for each start
+        // they are found in order of increasing length
+        Lattice lattice(word.size());
+        this->lookup.scan(word, [&lattice](std::size_t start,
+                                           std::size_t length,
+                                           std::uint32_t token) {
+            lattice[start].emplace_back(token, start + length);
+        });
+        return lattice;
+    }
+
+    /// @brief Build lattices of several words with a single batched pass of
+    /// the lookup automaton.
+    std::vector<Lattice> _build_lattices(
+        const std::vector<std::vector<std::uint32_t>>& words) const {
+        std::vector<Lattice> lattices;
+        lattices.reserve(words.size());
+        for (const auto& word : words) lattices.emplace_back(word.size());
+        this->lookup.scan_batch(
+            words, [&lattices](std::size_t index, std::size_t start,
+                               std::size_t length, std::uint32_t token) {
+                lattices[index][start].emplace_back(token, start + length);
+            });
+        return lattices;
+    }
+
+    /// @brief Compute weight of an encoding from counts of its tokens.
+    double _weight(const TokenCounts<std::uint32_t>& counter) const {
+        return std::accumulate(
+            counter.cbegin(), counter.cend(), 0.0,
+            [this](double total, const auto& element) {
+                double freq = element.second;
+                return total + (this->tokens_weights.contains(element.first)
+                                    ? (1.0 + std::log(freq)) *
+                                          this->tokens_weights.at(element.first)
+                                    : 0.0);
+            });
+    }
+
+    /// @brief Find the best encoding of a word.
+    /// @param word Sequence of basic tokens.
+    /// @param nodes For each start in the word, tokens that start there
+    /// paired with the starts of the following tokens.
+    /// @param memo Memo of suffixes' tails shared between words, optional.
+    ///
+    /// Note: the best tail is selected for each start from the end of the
+    /// word, as in the general search. Tokens at each start are checked in
+    /// order of the upper bounds of the weights they lead to, and the rest of
+    /// them are skipped as soon as the bound is below the best weight found.
+    /// Skipped tokens can not beat the best weight, and ties are resolved as
+    /// without skipping: the tail with fewer tokens, then the token found
+    /// first wins, so the result is the same as of the lattice search with
+    /// `top_n = 1`. Weights are summed in order of tokens, so encodings whose
+    /// weights are equal up to rounding may be chosen differently than by
+    /// versions that summed them in another order.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>>
+    _encode_word_best(
+        const std::vector<std::uint32_t>& word, const Lattice& nodes,
+        SuffixMemo* memo) const {
+        // relative tolerance of bounds to rounding errors of weights
+        constexpr double tolerance = 1e-9;
+
+        // the best tail from each start; tails are stored either in `memo`,
+        // or in `local` if they are not memoized
+        const BestTail end_tail;
+        std::vector<const BestTail*> tails(word.size() + 1);
+        tails[word.size()] = &end_tail;
+        std::vector<BestTail> local(word.size());
+        // nodes of the suffixes in `memo`
+        std::vector<std::uint32_t> suffixes(memo == nullptr ? 0
+                                                            : word.size() + 1);
+        if (memo != nullptr) {
+            memo->trim();
+            suffixes[word.size()] = SuffixMemo::ROOT;
         }
 
-        // build nodes
-        std::map<std::size_t,
-                 std::map<std::size_t, std::pair<std::uint32_t, std::size_t>>>
-            nodes;
-        // check all stacks form the end of `doc`
-        while (!stacks.empty()) {
-            // extract the top stack
-            auto [start, stack] = stacks.top();
-            stacks.pop();
-
-            // map which points keys (sequences of basic tokens) to pairs of
-            // values and starts of following tokens
-            std::map<std::size_t, std::pair<std::uint32_t, std::size_t>> next;
-            // process each candidate
-            for (const auto& [key_len, value] : stack) {
-                // compute the start of the following token
-                auto next_key_start = start + key_len;
-                // add candidate to the map
-                next[key_len] = std::make_pair(value, next_key_start);
-                // check if the following token was already added
-                if (next_key_start != word.size() &&
-                    !nodes.contains(next_key_start)) {
-                    // add new start-stack pairs to `stacks`
-                    stacks.emplace(std::make_pair(
-                        next_key_start,
-                        this->lookup(word, next_key_start, true)));
+        std::vector<std::pair<double, std::size_t>> order;
+        for (std::int64_t start = static_cast<std::int64_t>(word.size()) - 1;
+             start >= 0; start--) {
+            auto _start = static_cast<std::size_t>(start);
+
+            // long suffixes are not memoized
+            bool memoize = memo != nullptr &&
+                           word.size() - _start <= memo->get_max_length();
+            if (memoize) {
+                suffixes[_start] =
+                    memo->child(suffixes[_start + 1], word[_start]);
+                const auto& memoized = memo->at(suffixes[_start]).best;
+                if (memoized.has_value()) {
+                    tails[_start] = &memoized.value();
+                    continue;
+                }
+            }
+
+            const auto& node = nodes[_start];
+
+            // bounds of weights of the candidates
+            order.clear();
+            for (std::size_t i = 0; i < node.size(); i++) {
+                const auto& [token, next_start] = node[i];
+                double bound =
+                    tails[next_start]->weight +
+                    (token < this->weight_bounds.size()
+                         ? this->weight_bounds[token]
+                         : 0.0);
+                order.emplace_back(bound, i);
+            }
+            std::stable_sort(
+                order.begin(), order.end(),
+                [](const auto& lhs, const auto& rhs) {
+                    return lhs.first > rhs.first;
+                });
+
+            std::optional<BestTail> best = std::nullopt;
+            std::size_t best_index = 0;
+            for (const auto& [bound, i] : order) {
+                if (best.has_value() &&
+                    bound < best->weight -
+                                tolerance * (1.0 + std::abs(best->weight)))
+                    break;
+
+                const auto& [token, next_start] = node[i];
+                const auto& tail = *tails[next_start];
+                auto counter = tail.counter;
+                counter.increment(token);
+                double weight = this->_weight(counter);
+                std::size_t length = tail.length + 1;
+
+                if (!best.has_value() || best->weight < weight ||
+                    (best->weight == weight &&
+                     (best->length > length ||
+                      (best->length == length && best_index > i)))) {
+                    best = BestTail{weight, length, token,
+                                    next_start - _start, std::move(counter)};
+                    best_index = i;
                 }
             }
-            // create new node
-            nodes[start] = next;
+            if (!best.has_value())
+                throw std::invalid_argument("Unknown token in a word");
+
+            if (memoize) {
+                auto& memoized = memo->at(suffixes[_start]).best;
+                memoized = std::move(best.value());
+                tails[_start] = &memoized.value();
+            } else {
+                local[_start] = std::move(best.value());
+                tails[_start] = &local[_start];
+            }
+        }
+
+        // restore the sequence
+        std::vector<std::uint32_t> sequence;
+        sequence.reserve(tails[0]->length);
+        for (std::size_t start = 0; start < word.size();
+             start += tails[start]->span) {
+            sequence.emplace_back(tails[start]->token);
+        }
+        return {{std::move(sequence), tails[0]->weight}};
+    }
+
+    /// @brief Get the increase of `1 + log(count)` when `count` grows by one,
+    /// that is 1 for zero `count`, in single precision.
+    static float _count_gain(std::uint32_t count) {
+        static const auto gains = [] {
+            std::array<float, 64> gains{};
+            gains[0] = 1.0f;
+            for (std::size_t k = 1; k < gains.size(); k++) {
+                gains[k] = static_cast<float>(std::log1p(1.0 / k));
+            }
+            return gains;
+        }();
+        return count < gains.size()
+                   ? gains[count]
+                   : static_cast<float>(std::log1p(1.0 / count));
+    }
+
+    /// @brief Compute `scores[i] = bases[i] + scales[i] * gains[i]`.
+    /// @param size Number of elements, a multiple of the number of floats in
+    /// vector registers, so the loop is vectorized with no scalar remainder.
+    ///
+    /// Note: buffers must not overlap, so no checks of aliasing are needed.
+    static void _score_edges(const float* __restrict bases,
+                             const float* __restrict scales,
+                             const float* __restrict gains,
+                             float* __restrict scores, std::size_t size) {
+        for (std::size_t i = 0; i < size; i++) {
+            scores[i] = bases[i] + scales[i] * gains[i];
         }
+    }
 
-        // map that points start position to up to `top_n` candidate tails
-        std::map<std::size_t, std::vector<EncodingCandidate>> tails;
+    /// @brief Find the best encoding of a word with weights in single
+    /// precision.
+    /// @param word Sequence of basic tokens.
+    /// @param nodes Lattice of the word.
+    ///
+    /// Note: the weight of a tail is the weight of the following tail plus
+    /// `w * gain(c)`, where `w` is the weight of the first token and `c` is
+    /// its count in the following tail, so all the edges from a start are
+    /// scored in single precision by a single loop over aligned flat arrays.
+    /// Only the edges whose scores are within the relative `tolerance` of the
+    /// best score are scored again in double precision, and the best of them
+    /// is chosen as in the double precision search. Rounding errors of the
+    /// scores are below 4 units in the last place of the sum of magnitudes of
+    /// their terms, which is less than half of the `tolerance` for
+    /// nonnegative weights, that weights of fitted tokens are, so the tail
+    /// chosen for each start is the best one in double precision. Weights
+    /// in double precision are summed in another order than in the lattice
+    /// search, so tails whose weights are equal up to rounding may be chosen
+    /// differently, and as the best tail is chosen for each start separately,
+    /// this may change the result by more than rounding errors.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>>
+    _encode_word_best_f32(const std::vector<std::uint32_t>& word,
+                          const Lattice& nodes) const {
+        // relative difference of scores to the best one, within which the
+        // scores are computed again in double precision
+        constexpr float tolerance = 1e-6f;
+        // alignment of buffers that fits any vector registers
+        constexpr std::size_t alignment = 64;
+        // number of floats in the widest vector registers
+        constexpr std::size_t width = alignment / sizeof(float);
+        using Buffer = std::vector<float, AlignedAllocator<float, alignment>>;
+
+        std::vector<BestTail> tails(word.size() + 1);
+
+        // weights of the following tails, weights of the first tokens, gains
+        // of their counts and scores of the edges from a start
+        Buffer bases, scales, gains, scores;
+        for (std::int64_t start = static_cast<std::int64_t>(word.size()) - 1;
+             start >= 0; start--) {
+            auto _start = static_cast<std::size_t>(start);
+            const auto& node = nodes[_start];
+            if (node.empty())
+                throw std::invalid_argument("Unknown token in a word");
+
+            // buffers are padded to whole vector registers, so the scoring
+            // loop has no scalar remainder
+            auto padded = (node.size() + width - 1) / width * width;
+            bases.resize(padded);
+            scales.resize(padded);
+            gains.resize(padded);
+            scores.resize(padded);
+            for (std::size_t i = 0; i < node.size(); i++) {
+                const auto& [token, next_start] = node[i];
+                const auto& tail = tails[next_start];
+                bases[i] = static_cast<float>(tail.weight);
+                scales[i] = token < this->dense_weights.size()
+                                ? this->dense_weights[token]
+                                : 0.0f;
+                gains[i] = _count_gain(tail.counter.at(token));
+            }
+            _score_edges(bases.data(), scales.data(), gains.data(),
+                         scores.data(), padded);
+
+            float best_score = *std::max_element(
+                scores.cbegin(),
+                scores.cbegin() + static_cast<std::ptrdiff_t>(node.size()));
+            float threshold =
+                best_score - tolerance * (1.0f + std::abs(best_score));
+            std::size_t best = node.size();
+            double best_weight = 0.0;
+            for (std::size_t i = 0; i < node.size(); i++) {
+                if (scores[i] < threshold) continue;
+
+                const auto& [token, next_start] = node[i];
+                const auto& tail = tails[next_start];
+                auto count = tail.counter.at(token);
+                double weight =
+                    tail.weight +
+                    (token < this->exact_weights.size()
+                         ? this->exact_weights[token]
+                         : 0.0) *
+                        (count == 0 ? 1.0 : std::log1p(1.0 / count));
+
+                // the first of equal candidates is kept
+                if (best == node.size() || best_weight < weight ||
+                    (best_weight == weight &&
+                     tails[node[best].second].length > tail.length)) {
+                    best = i;
+                    best_weight = weight;
+                }
+            }
+
+            const auto& [token, next_start] = node[best];
+            auto& current = tails[_start];
+            current = {best_weight, tails[next_start].length + 1, token,
+                       next_start - _start, tails[next_start].counter};
+            current.counter.increment(token);
+        }
+
+        // restore the sequence
+        std::vector<std::uint32_t> sequence;
+        sequence.reserve(tails[0].length);
+        for (std::size_t start = 0; start < word.size();
+             start += tails[start].span) {
+            sequence.emplace_back(tails[start].token);
+        }
+        return {{std::move(sequence), this->_weight(tails[0].counter)}};
+    }
+
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode_word(
+        std::vector<std::uint32_t> word,
+        std::uint8_t top_n = 1) const override {
+        bool exact;
+        return this->_encode_word(word, top_n, std::nullopt, exact);
+    }
+
+    /// @brief Find up to `top_n` encodings of a word.
+    /// @param word Sequence of basic tokens.
+    /// @param top_n Number of encodings to find.
+    /// @param beam Pruning parameters; the search is exhaustive if not set.
+    /// @param exact Set to `false` if any candidate was pruned, so the result
+    /// may differ from the exhaustive search.
+    /// @param memo Memo of suffixes' tails shared between words, optional;
+    /// must not be used together with `beam`.
+    /// @param lattice Lattice of `word` if it is already built, optional.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> _encode_word(
+        const std::vector<std::uint32_t>& word, std::uint8_t top_n,
+        const std::optional<BeamConfig>& beam, bool& exact,
+        SuffixMemo* memo = nullptr, const Lattice* lattice = nullptr) const {
+        exact = true;
+
+        // build nodes: for each start in `word` the list of tokens that start
+        // there paired with the starts of the following tokens
+        Lattice built;
+        if (lattice == nullptr) {
+            built = this->_build_lattice(word);
+            lattice = &built;
+        }
+        const auto& nodes = *lattice;
+
+        if (top_n == 1) return this->_encode_word_best(word, nodes, memo);
+
+        // up to `top_n` candidate tails for each start position; tails are
+        // stored either in `memo`, or in `local` if they are not memoized
+        std::vector<const std::vector<EncodingCandidate>*> tails(word.size() +
+                                                                 1);
+        std::vector<std::vector<EncodingCandidate>> local(word.size());
+        // nodes of the suffixes in `memo`
+        std::vector<std::uint32_t> suffixes(memo == nullptr ? 0
+                                                            : word.size() + 1);
+        if (memo != nullptr) {
+            memo->trim();
+            suffixes[word.size()] = SuffixMemo::ROOT;
+        }
         // initialize a tail that is after the end of `doc`, that has zero
         // weight, is an empty sequence, and counts of it's tokens are zeros
-        tails[word.size()] = {
-            {0.0, std::vector<std::uint32_t>{}, Counter<std::uint32_t>()}};
+        const std::vector<EncodingCandidate> end_tails = {
+            {0.0, std::vector<std::uint32_t>{}, {}}};
+        tails[word.size()] = &end_tails;
         // form the end of `doc`
-        if (top_n == 1) {
-            for (std::int64_t start =
-                     static_cast<std::int64_t>(word.size() - 1);
-                 start >= 0; start--) {
-                auto _start = static_cast<std::size_t>(start);
-
-                // best candidate from `start`
-                std::optional<EncodingCandidate> buf = std::nullopt;
-                // for each subsequence from `start`
-                for (const auto& [_, node] : nodes[_start]) {
-                    const auto& [token, next_start] = node;
-                    // for each tail that starts where the subsequence ends
-                    for (const auto& [_, tail, counter] : tails[next_start]) {
-                        // new tail
-                        std::vector<std::uint32_t> buf_element = {token};
-                        buf_element.insert(buf_element.end(), tail.cbegin(),
-                                           tail.cend());
-                        // new counter
-                        auto buf_counter = counter;
-                        buf_counter[token]++;
-                        // weight of the tail
-                        double buf_weight = std::accumulate(
-                            buf_counter.cbegin(), buf_counter.cend(), 0.0,
-                            [this](double total, const auto& element) {
-                                double freq = element.second;
-                                return total +
-                                       (this->tokens_weights.contains(
-                                            element.first)
-                                            ? (1.0 + std::log(freq)) *
-                                                  this->tokens_weights.at(
-                                                      element.first)
-                                            : 0.0);
-                            });
-                        // add a new candidate
-                        if (!buf.has_value()) {
-                            buf = EncodingCandidate(buf_weight, buf_element,
-                                                    buf_counter);
-                        } else {
-                            if ((buf->weight == buf_weight &&
-                                 buf->sequence.size() > buf_element.size()) ||
-                                buf->weight < buf_weight) {
-                                buf = EncodingCandidate(buf_weight, buf_element,
-                                                        buf_counter);
-                            }
-                        }
-                    }
+        for (std::int64_t start = static_cast<std::int64_t>(word.size() - 1);
+             start >= 0; start--) {
+            auto _start = static_cast<std::size_t>(start);
+
+            // long suffixes are not memoized
+            bool memoize = memo != nullptr &&
+                           word.size() - _start <= memo->get_max_length();
+            if (memoize) {
+                suffixes[_start] =
+                    memo->child(suffixes[_start + 1], word[_start]);
+                const auto& memoized = memo->at(suffixes[_start]).candidates;
+                if (memoized.has_value()) {
+                    tails[_start] = &memoized.value();
+                    continue;
                 }
+            }
 
-                // add top candidate to `tails`
-                tails[_start] = {buf.value()};
+            // number of candidates kept at `start`
+            std::size_t width = beam.has_value() && _start != 0
+                                    ? std::min<std::size_t>(top_n, beam->width)
+                                    : top_n;
+            // all candidates from `start`
+            TopElements<EncodingCandidate> buf(width);
+            // for each subsequence from `start`
+            for (const auto& [token, next_start] : nodes[_start]) {
+                // for each tail that starts where the subsequence ends
+                for (const auto& [_, tail, counter] : *tails[next_start]) {
+                    // new tail
+                    std::vector<std::uint32_t> buf_element = {token};
+                    buf_element.insert(buf_element.end(), tail.cbegin(),
+                                       tail.cend());
+                    // new counter
+                    auto buf_counter = counter;
+                    buf_counter.increment(token);
+                    // weight of the tail
+                    double buf_weight = this->_weight(buf_counter);
+                    // add a new candidate
+                    buf.emplace(buf_weight, std::move(buf_element),
+                                std::move(buf_counter));
+                }
             }
-        } else {
-            for (std::int64_t start =
-                     static_cast<std::int64_t>(word.size() - 1);
-                 start >= 0; start--) {
-                auto _start = static_cast<std::size_t>(start);
-
-                // all candidates from `start`
-                TopElements<EncodingCandidate> buf(top_n);
-                // for each subsequence from `start`
-                for (const auto& [_, node] : nodes[_start]) {
-                    const auto& [token, next_start] = node;
-                    // for each tail that starts where the subsequence ends
-                    for (const auto& [_, tail, counter] : tails[next_start]) {
-                        // new tail
-                        std::vector<std::uint32_t> buf_element = {token};
-                        buf_element.insert(buf_element.end(), tail.cbegin(),
-                                           tail.cend());
-                        // new counter
-                        auto buf_counter = counter;
-                        buf_counter[token]++;
-                        // weight of the tail
-                        double buf_weight = std::accumulate(
-                            buf_counter.cbegin(), buf_counter.cend(), 0.0,
-                            [this](double total, const auto& element) {
-                                double freq = element.second;
-                                return total +
-                                       (this->tokens_weights.contains(
-                                            element.first)
-                                            ? (1.0 + std::log(freq)) *
-                                                  this->tokens_weights.at(
-                                                      element.first)
-                                            : 0.0);
-                            });
-                        // add a new candidate
-                        buf.push(EncodingCandidate(buf_weight, buf_element,
-                                                   buf_counter));
-                    }
+
+            // add top candidates to `tails`
+            auto kept = buf.extract();
+
+            if (beam.has_value()) {
+                // candidates that did not fit the beam
+                if (width < top_n && buf.pushed() > width) exact = false;
+                // candidates that are too light compared to the best one
+                if (!kept.empty() && std::isfinite(beam->margin)) {
+                    double threshold =
+                        std::max_element(kept.cbegin(), kept.cend(),
+                                         [](const auto& lhs, const auto& rhs) {
+                                             return lhs.weight < rhs.weight;
+                                         })
+                            ->weight -
+                        beam->margin;
+                    auto n_kept = kept.size();
+                    std::erase_if(kept, [threshold](const auto& element) {
+                        return element.weight < threshold;
+                    });
+                    if (kept.size() != n_kept) exact = false;
                 }
+            }
 
-                // add top candidates to `tails`
-                // no need to sort here
-                tails[_start] = buf.data();
+            if (memoize) {
+                auto& memoized = memo->at(suffixes[_start]).candidates;
+                memoized = std::move(kept);
+                tails[_start] = &memoized.value();
+            } else {
+                local[_start] = std::move(kept);
+                tails[_start] = &local[_start];
             }
         }
 
         // sort just here
-        std::stable_sort(tails[0].begin(), tails[0].end(),
+        auto result = *tails[0];
+        std::stable_sort(result.begin(), result.end(),
                          std::greater<EncodingCandidate>());
 
         // prepare result container
         std::vector<std::pair<std::vector<std::uint32_t>, double>> candidates;
-        candidates.reserve(tails[0].size());
+        candidates.reserve(result.size());
         // remove counter
-        std::transform(tails[0].cbegin(), tails[0].cend(),
+        std::transform(result.cbegin(), result.cend(),
                        std::back_inserter(candidates),
                        [](const auto& element) { return element(); });
         return candidates;
     }
 
+    /// @brief Encode a word by taking the longest token at each position.
+    /// @param word Sequence of basic tokens.
+    /// @return The only encoding of the word with its weight.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>>
+    _encode_word_greedy(const std::vector<std::uint32_t>& word) const {
+        std::vector<std::uint32_t> tokens;
+        tokens.reserve(word.size());
+        TokenCounts<std::uint32_t> counter;
+        for (std::size_t start = 0; start < word.size();) {
+            auto match = this->lookup.longest_prefix(word, start);
+            if (!match.has_value())
+                throw std::invalid_argument("Unknown token in the word");
+            tokens.emplace_back(match->second);
+            counter.increment(match->second);
+            start += match->first;
+        }
+
+        return {{std::move(tokens), this->_weight(counter)}};
+    }
+
+    /// @brief Combine encodings of words into up to `top_n` encodings of the
+    /// whole document.
+    /// @param parts Words of the document.
+    /// @param top_n Number of encodings to find.
+    /// @param encode_word Function that finds encodings of a single word.
+    template <typename F>
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> _encode_parts(
+        const std::vector<std::vector<std::uint32_t>>& parts,
+        std::uint8_t top_n, F&& encode_word) const {
+        // handle empty sequence
+        if (parts.empty()) return {{{}, 0.0}};
+        if (parts.size() == 1) return encode_word(parts[0], top_n);
+
+        if (top_n == 1) {
+            std::vector<std::uint32_t> result;
+            double weight = 0.0;
+            for (const auto& word : parts) {
+                if (word.size() == 1) {
+                    result.emplace_back(word[0]);
+                } else {
+                    auto [encoded_word, word_weight] =
+                        encode_word(word, 1)[0];
+                    result.insert(result.end(), encoded_word.begin(),
+                                  encoded_word.end());
+                    weight += word_weight;
+                }
+            }
+
+            return {{result, weight}};
+        }
+
+        // general case
+        std::vector<std::pair<std::vector<std::uint32_t>, double>> tails = {
+            {{}, 0.0}};
+
+        // iterate backwards
+        for (std::int64_t i = static_cast<std::int64_t>(parts.size() - 1);
+             i >= 0; i--) {
+            auto si = static_cast<std::size_t>(i);
+            if (parts[si].size() == 1) {
+                std::vector<std::pair<std::vector<std::uint32_t>, double>>
+                    new_tails(tails.size());
+                for (std::size_t j = 0; j < tails.size(); j++) {
+                    auto buf = parts[si];
+                    buf.reserve(tails[j].first.size() + 1);
+                    buf.insert(buf.end(), tails[j].first.begin(),
+                               tails[j].first.end());
+                    new_tails[j].first = std::move(buf);
+                    new_tails[j].second += tails[j].second;
+                }
+                tails = std::move(new_tails);
+            } else {
+                auto candidates = encode_word(parts[si], top_n);
+                std::size_t ti = 0, ci = 0;
+
+                std::vector<std::pair<std::vector<std::uint32_t>, double>>
+                    new_tails;
+
+                while (ci < candidates.size() && ti < tails.size() &&
+                       new_tails.size() < top_n) {
+                    // add new candidate
+                    auto buf = candidates[ci];
+                    buf.first.reserve(buf.first.size() +
+                                      tails[ti].first.size());
+                    buf.first.insert(buf.first.end(), tails[ti].first.begin(),
+                                     tails[ti].first.end());
+                    buf.second += tails[ti].second;
+                    new_tails.emplace_back(std::move(buf));
+
+                    if (new_tails.size() == top_n) break;
+
+                    if (ci == candidates.size() - 1 and ti == tails.size() - 1)
+                        break;
+
+                    if (ci == candidates.size() - 1 && ti < tails.size() - 1) {
+                        ti++;
+                    } else if (ti == tails.size() - 1 &&
+                               ci < candidates.size() - 1) {
+                        ci++;
+                    } else {
+                        if (tails[ti + 1].second + candidates[ci].second >
+                                tails[ti].second + candidates[ci + 1].second ||
+                            (tails[ti + 1].second + candidates[ci].second ==
+                                 tails[ti].second + candidates[ci + 1].second &&
+                             tails[ti + 1].first.size() +
+                                     candidates[ci].first.size() <
+                                 tails[ti].first.size() +
+                                     candidates[ci + 1].first.size())) {
+                            ti++;
+                        } else {
+                            ci++;
+                        }
+                    }
+                }
+                tails = std::move(new_tails);
+            }
+        }
+
+        return tails;
+    }
+
    public:
     Ubpe(std::uint32_t n_tokens, std::map<TokenType, std::uint32_t> alphabet,
          std::optional<std::map<DocType, std::uint32_t>> known_words =
@@ -291,14 +847,6 @@ class Ubpe : public UbpeBase<DocType, TokenType> {
               n_tokens, alphabet, inverse_alphabet, tokens_forward_mapper,
               tokens_backward_mapper, tokens_weights, known_words, break_tokens,
               regex_pattern, stop_tokens) {
-        // cache lookup of tokens for encoding
-        for (const auto& [key, value] : inverse_alphabet) {
-            auto _ = this->lookup +
-                     std::make_pair(std::vector<std::uint32_t>{key}, value);
-        }
-        for (const auto& element : tokens_forward_mapper) {
-            auto _ = this->lookup + element;
-        }
     }
 
     Ubpe(std::uint32_t n_tokens, std::map<TokenType, std::uint32_t> alphabet,
@@ -315,14 +863,15 @@ class Ubpe : public UbpeBase<DocType, TokenType> {
                                        tokens_forward_mapper,
                                        tokens_backward_mapper, tokens_weights,
                                        known_words, break_tokens, stop_tokens) {
-        // cache lookup of tokens for encoding
-        for (const auto& [key, value] : inverse_alphabet) {
-            auto _ = this->lookup +
-                     std::make_pair(std::vector<std::uint32_t>{key}, value);
-        }
-        for (const auto& element : tokens_forward_mapper) {
-            auto _ = this->lookup + element;
-        }
+    }
+
+    /// @brief Construct the tokenizer from its binary representation.
+    /// @param data Data written by `serialize`.
+    /// @param size Size of `data` in bytes.
+    Ubpe(const char* data, std::size_t size)
+        : Ubpe(BinaryReader(data, size)) {}
+    Ubpe(BinaryReader reader)
+        : UbpeBase<DocType, TokenType>(reader, false) {
     }
 
     Ubpe(const Ubpe&) = default;
@@ -331,314 +880,87 @@ class Ubpe : public UbpeBase<DocType, TokenType> {
     Ubpe& operator=(Ubpe&&) = default;
     ~Ubpe() = default;
 
+    using UbpeBase<DocType, TokenType>::fit;
+
     void fit(const std::vector<DocType>& corpus,
              std::uint32_t n_candidates = 50, bool rearrange_tokens = true,
              SplitMode::value_type split_mode = SplitMode::FULL,
              bool quiet = false) override {
-        if (!this->lookup.empty() || this->tokens_weights.size() != 0 ||
-            this->tokens_forward_mapper.size() != 0 ||
-            this->tokens_backward_mapper.size() != 0)
-            throw std::logic_error("Tokenizer can be fitted only once");
-
-        if (n_candidates == 0)
-            throw std::logic_error("`n_candidates` should not be 0");
+        this->_check_can_fit(n_candidates);
 
         auto logger =
             Logger({.scope = "Ubpe::fit", .quiet = quiet}, {.unit = "token"});
         logger.info("Starting fitting process");
 
-        std::vector<std::vector<std::vector<std::uint32_t>>> _corpus;
-        _corpus.reserve(corpus.size());
-        std::transform(corpus.cbegin(), corpus.cend(),
-                       std::back_inserter(_corpus),
-                       [this, &split_mode](const auto& doc) {
-                           return this->split_pipeline(doc, split_mode, false);
-                       });
+        auto _corpus = this->_split_corpus(corpus, split_mode);
         logger.info("Loaded the corpus");
 
-        auto max_token =
-            static_cast<std::uint32_t>(this->alphabet.size() +
-                                       (this->known_words.has_value()
-                                            ? this->known_words->size()
-                                            : 0)) -
-            1;
-
-        logger.info("Starting token building");
-        logger.progress(this->n_tokens, max_token + 1);
-        logger.progress.run();
-        // recursively fit tokenizer with `corpus`
-        while (max_token < this->n_tokens) {
-            // find number of occurences of each pair of adjacent tokens
-            auto pairs_counter = PairCounter<std::uint32_t>(_corpus);
-            // find most frequent bytepairs, a.k.a. candidates
-            auto mc = pairs_counter.most_common(n_candidates);
-            if (mc.size() == 0) break;
-
-            // find a banch of new tokens
-            // first candidate is always added
-            std::vector<
-                std::pair<std::pair<std::uint32_t, std::uint32_t>, std::size_t>>
-                token_pairs = {mc[0]};
-            // all substituted tokens must be distinct,
-            // and `current_set` tracks these tokens
-            std::set<std::uint32_t> current_set = {mc[0].first.first,
-                                                   mc[0].first.second};
-
-            // check each of top candidates from the second one
-            for (std::size_t i = 1; i < mc.size(); i++) {
-                const auto& [pair2, freq2] = mc[i];
-
-                if (current_set.contains(pair2.first) ||
-                    current_set.contains(pair2.second)) {
-                    continue;
-                }
-                // check that border pairs are not better
-                auto good_to_add = true;
-                for (const auto& [pair1, _] : token_pairs) {
-                    good_to_add =
-                        pairs_counter({pair2.second, pair1.first}).second <
-                            freq2 &&
-                        pairs_counter({pair1.second, pair2.first}).second <
-                            freq2;
-
-                    if (!good_to_add) break;
-                }
-                // finally add candidate if it is good
-                if (good_to_add) {
-                    token_pairs.emplace_back(std::make_pair(pair2, freq2));
-                    current_set.insert({pair2.first, pair2.second});
-                }
-            }
-
-            // merge subsequences for each pair of tokens and add it to the
-            // mapings
-            std::unordered_map<std::uint32_t,
-                               std::pair<std::uint32_t, std::uint32_t>>
-                sub;
-            for (const auto& [pair, _] : token_pairs) {
-                max_token++;
-                this->tokens_weights[max_token] = std::log(
-                    (1.0 + corpus.size()) / (1.0 + pairs_counter(pair).first));
-                // merge subsequences
-                std::vector<std::uint32_t> tokens_map;
-                if (this->tokens_backward_mapper.contains(pair.first)) {
-                    tokens_map.insert(
-                        tokens_map.end(),
-                        this->tokens_backward_mapper[pair.first].cbegin(),
-                        this->tokens_backward_mapper[pair.first].cend());
-                } else {
-                    tokens_map.emplace_back(pair.first);
-                }
-                if (this->tokens_backward_mapper.contains(pair.second)) {
-                    tokens_map.insert(
-                        tokens_map.end(),
-                        this->tokens_backward_mapper[pair.second].cbegin(),
-                        this->tokens_backward_mapper[pair.second].cend());
-                } else {
-                    tokens_map.emplace_back(pair.second);
-                }
-
-                this->tokens_backward_mapper[max_token] = tokens_map;
-                sub[pair.first] = {pair.second, max_token};
-            }
-
-            // update `corpus` with new tokens
-            std::for_each(_corpus.begin(), _corpus.end(),
-                          [this, &sub](auto& doc) {
-                              this->_replace_token_pairs(doc, sub);
-                          });
-            logger.progress.update(token_pairs.size());
-        }
-        logger.progress.stop();
-        logger.info("Built " +
-                    std::to_string(this->tokens_backward_mapper.size()) +
-                    " artificial tokens");
-
-        // rearrange fitted tokens
-        if (rearrange_tokens) {
-            this->_rearrange_tokens_by_weight(false);
-            logger.info("Rearranged artificial tokens: " +
-                        std::to_string(this->tokens_backward_mapper.size()) +
-                        " left");
-        }
-
-        this->n_tokens =
-            this->alphabet.size() +
-            (this->known_words.has_value() ? this->known_words->size() : 0) +
-            this->tokens_backward_mapper.size();
-
-        std::transform(
-            this->tokens_backward_mapper.cbegin(),
-            this->tokens_backward_mapper.cend(),
-            std::inserter(this->tokens_forward_mapper,
-                          this->tokens_forward_mapper.end()),
-            [](const auto& mapper)
-                -> std::pair<std::vector<std::uint32_t>, std::uint32_t> {
-                return {mapper.second, mapper.first};
-            });
-
-        // cache lookup of tokens for encoding
-        for (const auto& [key, value] : this->inverse_alphabet) {
-            auto _ = this->lookup +
-                     std::make_pair(std::vector<std::uint32_t>{key}, value);
-        }
-        for (const auto& element : this->tokens_forward_mapper) {
-            auto _ = this->lookup + element;
-        }
-        logger.info("Built the lookup tree");
+        this->_fit_merges(
+            this->_learn_merges(_corpus, corpus.size(), n_candidates, logger),
+            rearrange_tokens, logger);
     }
 
     void fit(std::vector<std::vector<std::vector<std::uint32_t>>> corpus,
              std::uint32_t n_candidates = 50, bool rearrange_tokens = true,
              bool quiet = false) override {
-        if (!this->lookup.empty() || this->tokens_weights.size() != 0 ||
-            this->tokens_forward_mapper.size() != 0 ||
-            this->tokens_backward_mapper.size() != 0)
-            throw std::logic_error("Tokenizer can be fitted only once");
-
-        if (n_candidates == 0)
-            throw std::logic_error("`n_candidates` should not be 0");
+        this->_check_can_fit(n_candidates);
 
         auto logger =
             Logger({.scope = "Ubpe::fit", .quiet = quiet}, {.unit = "token"});
         logger.info("Starting fitting process on splitted corpus");
 
-        auto max_token =
-            static_cast<std::uint32_t>(this->alphabet.size() +
-                                       (this->known_words.has_value()
-                                            ? this->known_words->size()
-                                            : 0)) -
-            1;
-
-        logger.info("Starting token building");
-        logger.progress(this->n_tokens, max_token + 1);
-        logger.progress.run();
-        // recursively fit tokenizer with `corpus`
-        while (max_token < this->n_tokens) {
-            // find number of occurences of each pair of adjacent tokens
-            auto pairs_counter = PairCounter<std::uint32_t>(corpus);
-            // find most frequent bytepairs, a.k.a. candidates
-            auto mc = pairs_counter.most_common(n_candidates);
-            if (mc.size() == 0) break;
-
-            // find a banch of new tokens
-            // first candidate is always added
-            std::vector<
-                std::pair<std::pair<std::uint32_t, std::uint32_t>, std::size_t>>
-                token_pairs = {mc[0]};
-            // all substituted tokens must be distinct,
-            // and `current_set` tracks these tokens
-            std::set<std::uint32_t> current_set = {mc[0].first.first,
-                                                   mc[0].first.second};
-
-            // check each of top candidates from the second one
-            for (std::size_t i = 1; i < mc.size(); i++) {
-                const auto& [pair2, freq2] = mc[i];
-
-                if (current_set.contains(pair2.first) ||
-                    current_set.contains(pair2.second)) {
-                    continue;
-                }
-                // check that border pairs are not better
-                auto good_to_add = true;
-                for (const auto& [pair1, _] : token_pairs) {
-                    good_to_add =
-                        pairs_counter({pair2.second, pair1.first}).second <
-                            freq2 &&
-                        pairs_counter({pair1.second, pair2.first}).second <
-                            freq2;
-
-                    if (!good_to_add) break;
-                }
-                // finally add candidate if it is good
-                if (good_to_add) {
-                    token_pairs.emplace_back(std::make_pair(pair2, freq2));
-                    current_set.insert({pair2.first, pair2.second});
-                }
-            }
+        auto n_documents = corpus.size();
+        this->_fit_merges(
+            this->_learn_merges(corpus, n_documents, n_candidates, logger),
+            rearrange_tokens, logger);
+    }
 
-            // merge subsequences for each pair of tokens and add it to the
-            // mapings
-            std::unordered_map<std::uint32_t,
-                               std::pair<std::uint32_t, std::uint32_t>>
-                sub;
-            for (const auto& [pair, _] : token_pairs) {
-                max_token++;
-                this->tokens_weights[max_token] = std::log(
-                    (1.0 + corpus.size()) / (1.0 + pairs_counter(pair).first));
-                // merge subsequences
-                std::vector<std::uint32_t> tokens_map;
-                if (this->tokens_backward_mapper.contains(pair.first)) {
-                    tokens_map.insert(
-                        tokens_map.end(),
-                        this->tokens_backward_mapper[pair.first].cbegin(),
-                        this->tokens_backward_mapper[pair.first].cend());
-                } else {
-                    tokens_map.emplace_back(pair.first);
-                }
-                if (this->tokens_backward_mapper.contains(pair.second)) {
-                    tokens_map.insert(
-                        tokens_map.end(),
-                        this->tokens_backward_mapper[pair.second].cbegin(),
-                        this->tokens_backward_mapper[pair.second].cend());
-                } else {
-                    tokens_map.emplace_back(pair.second);
-                }
+    void finish_fit(std::uint32_t n_candidates = 50,
+                    bool rearrange_tokens = true, bool quiet = false) override {
+        if (!this->word_table.has_value())
+            throw std::logic_error(
+                "Fit is not started, call `begin_fit` first");
 
-                this->tokens_backward_mapper[max_token] = tokens_map;
-                sub[pair.first] = {pair.second, max_token};
-            }
+        if (n_candidates == 0)
+            throw std::logic_error("`n_candidates` should not be 0");
 
-            // update `corpus` with new tokens
-            std::for_each(corpus.begin(), corpus.end(),
-                          [this, &sub](auto& doc) {
-                              this->_replace_token_pairs(doc, sub);
-                          });
-            logger.progress.update(token_pairs.size());
-        }
-        logger.progress.stop();
-        logger.info("Built " +
-                    std::to_string(this->tokens_backward_mapper.size()) +
-                    " artificial tokens");
-
-        // rearrange fitted tokens
-        if (rearrange_tokens) {
-            this->_rearrange_tokens_by_weight(false);
-            logger.info("Rearranged artificial tokens: " +
-                        std::to_string(this->tokens_backward_mapper.size()) +
-                        " left");
-        }
+        auto logger = Logger({.scope = "Ubpe::finish_fit", .quiet = quiet},
+                             {.unit = "token"});
+        logger.info("Starting fitting process on " +
+                    std::to_string(this->word_table->size()) +
+                    " unique words");
+
+        auto& table = *this->word_table;
+        table.freeze();
+        auto history = this->_learn_merges(table, table.documents(),
+                                           n_candidates, logger);
+        this->word_table.reset();
+        this->_fit_merges(history, rearrange_tokens, logger);
+    }
 
-        this->n_tokens =
-            this->alphabet.size() +
-            (this->known_words.has_value() ? this->known_words->size() : 0) +
-            this->tokens_backward_mapper.size();
+    void fit_merges(const MergeHistory& history, bool rearrange_tokens = true,
+                    bool quiet = false) override {
+        this->_check_can_fit(1);
 
-        std::transform(
-            this->tokens_backward_mapper.cbegin(),
-            this->tokens_backward_mapper.cend(),
-            std::inserter(this->tokens_forward_mapper,
-                          this->tokens_forward_mapper.end()),
-            [](const auto& mapper)
-                -> std::pair<std::vector<std::uint32_t>, std::uint32_t> {
-                return {mapper.second, mapper.first};
-            });
+        auto logger = Logger({.scope = "Ubpe::fit_merges", .quiet = quiet});
+        logger.info("Starting fitting process with " +
+                    std::to_string(history.merges.size()) + " merges");
+        this->_fit_merges(history, rearrange_tokens, logger);
+    }
 
-        // cache lookup of tokens for encoding
-        for (const auto& [key, value] : this->inverse_alphabet) {
-            auto _ = this->lookup +
-                     std::make_pair(std::vector<std::uint32_t>{key}, value);
-        }
-        for (const auto& element : this->tokens_forward_mapper) {
-            auto _ = this->lookup + element;
-        }
-        logger.info("Built the lookup tree");
+    std::string serialize() const override {
+        return this->_serialize(false);
+    }
+
+    std::string embed(const std::string& name) const override {
+        return this->_embed(name, false);
     }
 
     void rearrange_tokens(std::optional<std::uint32_t> n_tokens,
                           bool quiet) override {
+        this->_ensure_mappers();
+        this->_ensure_cache();
         if (this->lookup.empty() || this->tokens_weights.size() == 0 ||
-            this->tokens_forward_mapper.size() == 0 ||
             this->tokens_backward_mapper.size() == 0)
             throw std::logic_error("Tokenizer is not fitted");
 
@@ -673,23 +995,16 @@ class Ubpe : public UbpeBase<DocType, TokenType> {
             });
 
         // cache lookup of tokens for encoding
-        this->lookup = {};
-        for (const auto& [key, value] : this->inverse_alphabet) {
-            auto _ = this->lookup +
-                     std::make_pair(std::vector<std::uint32_t>{key}, value);
-        }
-        for (const auto& element : this->tokens_forward_mapper) {
-            auto _ = this->lookup + element;
-        }
-        logger.info("Updated the lookup tree");
+        this->_build_lookup();
+        logger.info("Updated the lookup automaton");
     }
     using UbpeBase<DocType, TokenType>::rearrange_tokens;
 
     std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
         const DocType& doc, std::uint8_t top_n,
         SplitMode::value_type split_mode) const override {
+        this->_ensure_cache();
         if (this->lookup.empty() || this->tokens_weights.size() == 0 ||
-            this->tokens_forward_mapper.size() == 0 ||
             this->tokens_backward_mapper.size() == 0)
             throw std::logic_error("Tokenizer is not fitted");
         if (top_n < 1)
@@ -698,204 +1013,234 @@ class Ubpe : public UbpeBase<DocType, TokenType> {
         // handle empty sequence
         if (doc.size() == 0) return {};
 
-        auto parts = this->split_pipeline(doc, split_mode);
-        if (parts.empty()) return {{{}, 0.0}};
-        if (parts.size() == 1) return this->encode_word(parts[0], top_n);
-
-        if (top_n == 1) {
-            std::vector<std::uint32_t> result;
-            double weight = 0.0;
-            for (const auto& word : parts) {
-                if (word.size() == 1) {
-                    result.emplace_back(word[0]);
-                } else {
-                    auto [encoded_word, word_weight] =
-                        this->encode_word(word)[0];
-                    result.insert(result.end(), encoded_word.begin(),
-                                  encoded_word.end());
-                    weight += word_weight;
-                }
-            }
-
-            return {{result, weight}};
-        }
-
-        // general case
-        std::vector<std::pair<std::vector<std::uint32_t>, double>> tails = {
-            {{}, 0.0}};
-
-        // iterate backwards
-        for (std::int64_t i = static_cast<std::int64_t>(parts.size() - 1);
-             i >= 0; i--) {
-            auto si = static_cast<std::size_t>(i);
-            if (parts[si].size() == 1) {
-                std::vector<std::pair<std::vector<std::uint32_t>, double>>
-                    new_tails(tails.size());
-                for (std::size_t j = 0; j < tails.size(); j++) {
-                    auto buf = parts[si];
-                    buf.reserve(tails[j].first.size() + 1);
-                    buf.insert(buf.end(), tails[j].first.begin(),
-                               tails[j].first.end());
-                    new_tails[j].first = std::move(buf);
-                    new_tails[j].second += tails[j].second;
-                }
-                tails = std::move(new_tails);
-            } else {
-                auto candidates = this->encode_word(parts[si], top_n);
-                std::size_t ti = 0, ci = 0;
-
-                std::vector<std::pair<std::vector<std::uint32_t>, double>>
-                    new_tails;
-
-                while (ci < candidates.size() && ti < tails.size() &&
-                       new_tails.size() < top_n) {
-                    // add new candidate
-                    auto buf = candidates[ci];
-                    buf.first.reserve(buf.first.size() +
-                                      tails[ti].first.size());
-                    buf.first.insert(buf.first.end(), tails[ti].first.begin(),
-                                     tails[ti].first.end());
-                    buf.second += tails[ti].second;
-                    new_tails.emplace_back(std::move(buf));
-
-                    if (new_tails.size() == top_n) break;
-
-                    if (ci == candidates.size() - 1 and ti == tails.size() - 1)
-                        break;
-
-                    if (ci == candidates.size() - 1 && ti < tails.size() - 1) {
-                        ti++;
-                    } else if (ti == tails.size() - 1 &&
-                               ci < candidates.size() - 1) {
-                        ci++;
-                    } else {
-                        if (tails[ti + 1].second + candidates[ci].second >
-                                tails[ti].second + candidates[ci + 1].second ||
-                            (tails[ti + 1].second + candidates[ci].second ==
-                                 tails[ti].second + candidates[ci + 1].second &&
-                             tails[ti + 1].first.size() +
-                                     candidates[ci].first.size() <
-                                 tails[ti].first.size() +
-                                     candidates[ci + 1].first.size())) {
-                            ti++;
-                        } else {
-                            ci++;
-                        }
-                    }
-                }
-                tails = std::move(new_tails);
-            }
-        }
-
-        return tails;
+        auto parts = this->_get_split_pipeline()(doc, split_mode);
+        return this->_encode_parts(
+            parts, top_n,
+            [this](const std::vector<std::uint32_t>& word,
+                   std::uint8_t top_n) {
+                return this->encode_word(word, top_n);
+            });
     }
     using UbpeBase<DocType, TokenType>::encode;
 
     std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
         const std::vector<std::vector<std::uint32_t>>& parts,
         std::uint8_t top_n = 1) const override {
+        this->_ensure_cache();
         if (this->lookup.empty() || this->tokens_weights.size() == 0 ||
-            this->tokens_forward_mapper.size() == 0 ||
             this->tokens_backward_mapper.size() == 0)
             throw std::logic_error("Tokenizer is not fitted");
         if (top_n < 1)
             throw std::invalid_argument("top_n must be greater than 0");
 
-        // handle empty sequence
-        if (parts.empty()) return {{{}, 0.0}};
-        if (parts.size() == 1) return this->encode_word(parts[0], top_n);
-
-        if (top_n == 1) {
-            std::vector<std::uint32_t> result;
-            double weight = 0.0;
-            for (const auto& word : parts) {
-                if (word.size() == 1) {
-                    result.emplace_back(word[0]);
-                } else {
-                    auto [encoded_word, word_weight] =
-                        this->encode_word(word)[0];
-                    result.insert(result.end(), encoded_word.begin(),
-                                  encoded_word.end());
-                    weight += word_weight;
-                }
-            }
+        return this->_encode_parts(
+            parts, top_n,
+            [this](const std::vector<std::uint32_t>& word,
+                   std::uint8_t top_n) {
+                return this->encode_word(word, top_n);
+            });
+    }
 
-            return {{result, weight}};
+    /// @brief Encode a document with the chosen search.
+    /// @param doc Sequence of basic tokens to encode.
+    /// @param top_n Number of encodings to return; the greedy and the single
+    /// precision searches return a single encoding.
+    /// @param split_mode Split mode.
+    /// @param encode_mode Search used to encode words.
+    /// @return List of encoded documents with weights.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
+        const DocType& doc, std::uint8_t top_n,
+        SplitMode::value_type split_mode, EncodeMode encode_mode) const {
+        if (encode_mode == EncodeMode::LATTICE)
+            return this->encode(doc, top_n, split_mode);
+        if (doc.size() == 0) {
+            // keep the same checks as the lattice search
+            return this->encode(doc, top_n, split_mode);
         }
+        return this->encode(this->_get_split_pipeline()(doc, split_mode),
+                            top_n, encode_mode);
+    }
 
-        // general case
-        std::vector<std::pair<std::vector<std::uint32_t>, double>> tails = {
-            {{}, 0.0}};
+    /// @brief Encode a document with the chosen search.
+    /// @param parts Vector of vectors of basic tokens to encode.
+    /// @param top_n Number of encodings to return; the greedy and the single
+    /// precision searches return a single encoding.
+    /// @param encode_mode Search used to encode words.
+    /// @return List of encoded documents with weights.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
+        const std::vector<std::vector<std::uint32_t>>& parts,
+        std::uint8_t top_n, EncodeMode encode_mode) const {
+        if (encode_mode == EncodeMode::LATTICE)
+            return this->encode(parts, top_n);
+        this->_ensure_cache();
+        if (this->lookup.empty() || this->tokens_weights.size() == 0 ||
+            this->tokens_backward_mapper.size() == 0)
+            throw std::logic_error("Tokenizer is not fitted");
+        if (top_n < 1)
+            throw std::invalid_argument("top_n must be greater than 0");
 
-        // iterate backwards
-        for (std::int64_t i = static_cast<std::int64_t>(parts.size() - 1);
-             i >= 0; i--) {
-            auto si = static_cast<std::size_t>(i);
-            if (parts[si].size() == 1) {
-                std::vector<std::pair<std::vector<std::uint32_t>, double>>
-                    new_tails(tails.size());
-                for (std::size_t j = 0; j < tails.size(); j++) {
-                    auto buf = parts[si];
-                    buf.reserve(tails[j].first.size() + 1);
-                    buf.insert(buf.end(), tails[j].first.begin(),
-                               tails[j].first.end());
-                    new_tails[j].first = std::move(buf);
-                    new_tails[j].second += tails[j].second;
-                }
-                tails = std::move(new_tails);
-            } else {
-                auto candidates = this->encode_word(parts[si], top_n);
-                std::size_t ti = 0, ci = 0;
+        if (encode_mode == EncodeMode::LATTICE_F32) {
+            return this->_encode_parts(
+                parts, 1,
+                [this](const std::vector<std::uint32_t>& word, std::uint8_t) {
+                    return this->_encode_word_best_f32(
+                        word, this->_build_lattice(word));
+                });
+        }
+        return this->_encode_parts(
+            parts, 1,
+            [this](const std::vector<std::uint32_t>& word, std::uint8_t) {
+                return this->_encode_word_greedy(word);
+            });
+    }
 
-                std::vector<std::pair<std::vector<std::uint32_t>, double>>
-                    new_tails;
+    /// @brief Encode a document reusing tails of words' suffixes.
+    /// @param doc Sequence of basic tokens to encode.
+    /// @param top_n Number of encodings to return.
+    /// @param split_mode Split mode.
+    /// @param memo Memo of suffixes' tails created for the same `top_n`.
+    /// @return List of encoded documents with weights, the same as of
+    /// `encode` without a memo.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
+        const DocType& doc, std::uint8_t top_n,
+        SplitMode::value_type split_mode, SuffixMemo& memo) const {
+        if (doc.size() == 0) {
+            // keep the same checks as `encode` without a memo
+            return this->encode(doc, top_n, split_mode);
+        }
+        return this->encode(this->_get_split_pipeline()(doc, split_mode),
+                            top_n, memo);
+    }
 
-                while (ci < candidates.size() && ti < tails.size() &&
-                       new_tails.size() < top_n) {
-                    // add new candidate
-                    auto buf = candidates[ci];
-                    buf.first.reserve(buf.first.size() +
-                                      tails[ti].first.size());
-                    buf.first.insert(buf.first.end(), tails[ti].first.begin(),
-                                     tails[ti].first.end());
-                    buf.second += tails[ti].second;
-                    new_tails.emplace_back(std::move(buf));
+    /// @brief Encode a document reusing tails of words' suffixes.
+    /// @param parts Vector of vectors of basic tokens to encode.
+    /// @param top_n Number of encodings to return.
+    /// @param memo Memo of suffixes' tails created for the same `top_n`.
+    /// @return List of encoded documents with weights, the same as of
+    /// `encode` without a memo.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
+        const std::vector<std::vector<std::uint32_t>>& parts,
+        std::uint8_t top_n, SuffixMemo& memo) const {
+        this->_ensure_cache();
+        if (this->lookup.empty() || this->tokens_weights.size() == 0 ||
+            this->tokens_backward_mapper.size() == 0)
+            throw std::logic_error("Tokenizer is not fitted");
+        if (top_n < 1)
+            throw std::invalid_argument("top_n must be greater than 0");
+        if (memo.get_top_n() != top_n)
+            throw std::invalid_argument(
+                "`memo` was created for another `top_n`");
+
+        // lattices of all the words are built at once
+        auto lattices = this->_build_lattices(parts);
+        return this->_encode_parts(
+            parts, top_n,
+            [this, &memo, &parts, &lattices](
+                const std::vector<std::uint32_t>& word, std::uint8_t top_n) {
+                // `_encode_parts` passes elements of `parts`
+                auto index = static_cast<std::size_t>(&word - parts.data());
+                bool exact;
+                return this->_encode_word(word, top_n, std::nullopt, exact,
+                                          &memo, &lattices[index]);
+            });
+    }
 
-                    if (new_tails.size() == top_n) break;
+    /// @brief Encode documents, sharing tails of words' suffixes between
+    /// them.
+    /// @param docs Documents to encode.
+    /// @param top_n Number of encodings to return for each document.
+    /// @param split_mode Split mode.
+    /// @return List of encoded documents with weights for each document.
+    std::vector<std::vector<std::pair<std::vector<std::uint32_t>, double>>>
+    encode_batch(const std::vector<DocType>& docs, std::uint8_t top_n = 1,
+                 SplitMode::value_type split_mode = SplitMode::FULL) const {
+        SuffixMemo memo(top_n);
+        std::vector<std::vector<std::pair<std::vector<std::uint32_t>, double>>>
+            results;
+        results.reserve(docs.size());
+        for (const auto& doc : docs) {
+            results.emplace_back(this->encode(doc, top_n, split_mode, memo));
+        }
+        return results;
+    }
 
-                    if (ci == candidates.size() - 1 and ti == tails.size() - 1)
-                        break;
+    /// @brief Encode documents, sharing tails of words' suffixes between
+    /// them.
+    /// @param docs Documents split into vectors of basic tokens.
+    /// @param top_n Number of encodings to return for each document.
+    /// @return List of encoded documents with weights for each document.
+    std::vector<std::vector<std::pair<std::vector<std::uint32_t>, double>>>
+    encode_batch(
+        const std::vector<std::vector<std::vector<std::uint32_t>>>& docs,
+        std::uint8_t top_n = 1) const {
+        SuffixMemo memo(top_n);
+        std::vector<std::vector<std::pair<std::vector<std::uint32_t>, double>>>
+            results;
+        results.reserve(docs.size());
+        for (const auto& parts : docs) {
+            results.emplace_back(this->encode(parts, top_n, memo));
+        }
+        return results;
+    }
 
-                    if (ci == candidates.size() - 1 && ti < tails.size() - 1) {
-                        ti++;
-                    } else if (ti == tails.size() - 1 &&
-                               ci < candidates.size() - 1) {
-                        ci++;
-                    } else {
-                        if (tails[ti + 1].second + candidates[ci].second >
-                                tails[ti].second + candidates[ci + 1].second ||
-                            (tails[ti + 1].second + candidates[ci].second ==
-                                 tails[ti].second + candidates[ci + 1].second &&
-                             tails[ti + 1].first.size() +
-                                     candidates[ci].first.size() <
-                                 tails[ti].first.size() +
-                                     candidates[ci + 1].first.size())) {
-                            ti++;
-                        } else {
-                            ci++;
-                        }
-                    }
-                }
-                tails = std::move(new_tails);
-            }
+    /// @brief Approximately encode a document with beam pruning of candidates.
+    /// @param doc Sequence of basic tokens to encode.
+    /// @param top_n Number of encodings to return.
+    /// @param beam Pruning parameters.
+    /// @param split_mode Split mode.
+    /// @return List of encoded documents with weights, and a flag that is
+    /// `true` if nothing was pruned, so the result is the same as `encode`
+    /// would return.
+    std::pair<std::vector<std::pair<std::vector<std::uint32_t>, double>>, bool>
+    encode_approx(const DocType& doc, std::uint8_t top_n,
+                  const BeamConfig& beam = BeamConfig(),
+                  SplitMode::value_type split_mode = SplitMode::FULL) const {
+        if (doc.size() == 0) {
+            // keep the same checks as `encode`
+            return {this->encode(doc, top_n, split_mode), true};
         }
+        return this->encode_approx(
+            this->_get_split_pipeline()(doc, split_mode), top_n, beam);
+    }
 
-        return tails;
+    /// @brief Approximately encode a document with beam pruning of candidates.
+    /// @param parts Vector of vectors of basic tokens to encode.
+    /// @param top_n Number of encodings to return.
+    /// @param beam Pruning parameters.
+    /// @return List of encoded documents with weights, and a flag that is
+    /// `true` if nothing was pruned, so the result is the same as `encode`
+    /// would return.
+    std::pair<std::vector<std::pair<std::vector<std::uint32_t>, double>>, bool>
+    encode_approx(const std::vector<std::vector<std::uint32_t>>& parts,
+                  std::uint8_t top_n,
+                  const BeamConfig& beam = BeamConfig()) const {
+        this->_ensure_cache();
+        if (this->lookup.empty() || this->tokens_weights.size() == 0 ||
+            this->tokens_backward_mapper.size() == 0)
+            throw std::logic_error("Tokenizer is not fitted");
+        if (top_n < 1)
+            throw std::invalid_argument("top_n must be greater than 0");
+        if (beam.width < 1)
+            throw std::invalid_argument("beam width must be greater than 0");
+        if (!(beam.margin >= 0.0))
+            throw std::invalid_argument("beam margin must not be negative");
+
+        bool exact = true;
+        auto candidates = this->_encode_parts(
+            parts, top_n,
+            [this, &beam, &exact](const std::vector<std::uint32_t>& word,
+                                  std::uint8_t top_n) {
+                bool word_exact;
+                auto result =
+                    this->_encode_word(word, top_n, beam, word_exact);
+                exact = exact && word_exact;
+                return result;
+            });
+        return {std::move(candidates), exact};
     }
 
     DocType decode(const std::vector<std::uint32_t>& tokens) const override {
-        if (this->lookup.empty() || this->tokens_weights.size() == 0 ||
-            this->tokens_forward_mapper.size() == 0 ||
+        if (this->tokens_weights.size() == 0 ||
             this->tokens_backward_mapper.size() == 0)
             throw std::logic_error("Tokenizer is not fitted");
 
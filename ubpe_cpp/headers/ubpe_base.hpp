@@ -2,21 +2,38 @@
 #define UBPE_BASE_CPP
 
 #include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <filesystem>
+#include <future>
 #include <iterator>
 #include <map>
+#include <memory>
+#include <numeric>
 #include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#include "cancellation.hpp"
+#include "embedding.hpp"
+#include "lazy_flag.hpp"
+#include "logger.hpp"
+#include "merge_history.hpp"
+#include "pair_counter.hpp"
+#include "serialization.hpp"
+#include "spilling_pair_counter.hpp"
 #include "splitter.hpp"
 #include "utils.hpp"
+#include "word_table.hpp"
 
 namespace ubpe {
 
@@ -26,19 +43,367 @@ class UbpeBase {
     std::uint32_t n_tokens;
 
     std::map<TokenType, std::uint32_t> alphabet;
-    std::map<std::uint32_t, TokenType> inverse_alphabet;
+    mutable std::map<std::uint32_t, TokenType> inverse_alphabet;
 
-    std::map<std::vector<std::uint32_t>, std::uint32_t> tokens_forward_mapper;
+    mutable std::map<std::vector<std::uint32_t>, std::uint32_t>
+        tokens_forward_mapper;
     std::map<std::uint32_t, std::vector<std::uint32_t>> tokens_backward_mapper;
 
     std::map<std::uint32_t, double> tokens_weights;
 
     std::optional<std::map<DocType, std::uint32_t>> known_words{};
-    std::optional<std::map<std::uint32_t, DocType>> inverse_known_words{};
+    mutable std::optional<std::map<std::uint32_t, DocType>>
+        inverse_known_words{};
     std::optional<std::set<TokenType>> break_tokens{};
     [[no_unique_address]] OptionalPatternType<TokenType> regex_pattern{};
     std::optional<std::set<TokenType>> stop_tokens{};
-    SplitPipeline<DocType, TokenType> split_pipeline{};
+    mutable SplitPipeline<DocType, TokenType> split_pipeline{};
+    /// Flags of derived structures, which loaded tokenizers build on first
+    /// use: the inverse mappers, the split pipeline, and the cache for
+    /// encoding of subclasses.
+    LazyFlag mappers_built{true};
+    LazyFlag split_pipeline_built{true};
+    LazyFlag cache_built{true};
+    UnknownPolicy unknown_policy = UnknownPolicy::RAISE;
+    /// Symbol that replaces unknown symbols and tokens for
+    /// `UnknownPolicy::REPLACE`.
+    std::optional<TokenType> unknown_replacement{};
+    /// Maximum number of basic tokens a new token may expand to.
+    std::optional<std::uint32_t> max_token_length{};
+    /// Maximum memory in bytes for counts of pairs while fitting, beyond
+    /// which counts are spilled to disk; not serialized.
+    std::optional<std::size_t> pair_memory_budget{};
+    /// Directory for spilled counts of pairs; the temporary directory of the
+    /// system if empty.
+    std::string spill_directory{};
+    /// Token to stop fitting early; not serialized.
+    std::shared_ptr<CancellationToken> cancellation_token{};
+    /// Maximum duration of merge rounds of a fit in seconds; not serialized.
+    std::optional<double> time_budget{};
+    /// Callback to stop fitting early, with its context; not serialized.
+    StopCallback stop_callback = nullptr;
+    void* stop_context = nullptr;
+
+    /// Unique words of the corpus collected by `add_documents` between
+    /// `begin_fit` and `finish_fit`.
+    std::optional<WordTable<std::uint32_t>> word_table{};
+    /// Merges made by the last fit, to derive smaller tokenizers from;
+    /// not serialized.
+    std::optional<MergeHistory> merge_history{};
+
+    /// Version of the binary representation written by `_serialize`.
+    static constexpr std::uint8_t SERIALIZATION_VERSION = 2;
+    /// Mark to detect byte order of the binary representation.
+    static constexpr std::uint16_t BYTE_ORDER_MARK = 0x0102;
+
+    /// @brief Write the model to a compact binary representation.
+    /// @param is_classic If the model is `UbpeClassic`; models of different
+    /// classes are not interchangeable, as their backward mappers differ.
+    /// @return Binary representation of the model.
+    ///
+    /// Note: only primary data is written; derived structures like forward
+    /// mapper and lookup caches are rebuilt on reading.
+    std::string _serialize(bool is_classic) const {
+        BinaryWriter writer;
+        for (const auto& c : {'U', 'B', 'P', 'E'}) writer.write(c);
+        writer.write(SERIALIZATION_VERSION);
+        writer.write(BYTE_ORDER_MARK);
+        writer.write(static_cast<std::uint8_t>(is_classic));
+        writer.write(static_cast<std::uint8_t>(sizeof(TokenType)));
+
+        writer.write(this->n_tokens);
+        writer.write(this->alphabet);
+        writer.write(this->tokens_backward_mapper);
+        writer.write(this->tokens_weights);
+        writer.write(this->known_words);
+        writer.write(this->break_tokens);
+        if constexpr (!std::is_same_v<OptionalPatternType<TokenType>,
+                                      std::monostate>) {
+            writer.write(this->regex_pattern);
+        } else {
+            writer.write(std::uint8_t(0));
+        }
+        writer.write(this->stop_tokens);
+        writer.write(this->max_token_length);
+        return writer.data();
+    }
+
+    /// @brief Check that tokens of a model read by `BinaryReader` are
+    /// consistent, so that broken data is not used.
+    /// @param is_classic If the model is `UbpeClassic`.
+    ///
+    /// Note: throws `std::runtime_error` as the reader does for broken data.
+    void _check_loaded(bool is_classic) const {
+        std::vector<bool> seen(this->alphabet.size(), false);
+        for (const auto& [_, token] : this->alphabet) {
+            if (token >= seen.size() || seen[token])
+                throw std::runtime_error(
+                    "Model data has non-sequential alphabet tokens");
+            seen[token] = true;
+        }
+        if (this->known_words.has_value()) {
+            seen.assign(this->known_words->size(), false);
+            for (const auto& [word, token] : *this->known_words) {
+                auto i = token - this->alphabet.size();
+                if (token < this->alphabet.size() || i >= seen.size() ||
+                    seen[i] || word.empty())
+                    throw std::runtime_error(
+                        "Model data has invalid known words");
+                seen[i] = true;
+            }
+        }
+
+        // artificial tokens follow the base tokens up to `n_tokens`
+        auto n_base_tokens = this->_n_base_tokens();
+        const auto& mapper = this->tokens_backward_mapper;
+        if (!mapper.empty() &&
+            (mapper.cbegin()->first != n_base_tokens ||
+             mapper.crbegin()->first + 1 != this->n_tokens ||
+             mapper.size() != this->n_tokens - n_base_tokens))
+            throw std::runtime_error(
+                "Model data has non-sequential artificial tokens");
+        for (const auto& [token, _] : this->tokens_weights) {
+            if (!mapper.contains(token))
+                throw std::runtime_error(
+                    "Model data has weights of unknown tokens");
+        }
+        for (const auto& [token, tokens] : mapper) {
+            // expansions of `UbpeClassic` are pairs of tokens, and those of
+            // `Ubpe` are base tokens
+            auto bound = is_classic ? this->n_tokens : n_base_tokens;
+            if (tokens.size() < 2 || (is_classic && tokens.size() != 2) ||
+                std::any_of(tokens.cbegin(), tokens.cend(),
+                            [bound](auto part) { return part >= bound; }))
+                throw std::runtime_error(
+                    "Model data has expansions of unknown tokens");
+        }
+        if (!is_classic) return;
+
+        // pairs of `UbpeClassic` must expand to base tokens, so they can not
+        // contain the tokens they expand
+        // `0` --- not visited, `1` --- being expanded, `2` --- expanded
+        std::vector<std::uint8_t> state(mapper.size(), 0);
+        std::vector<std::pair<std::uint32_t, std::size_t>> stack;
+        for (const auto& [root, _] : mapper) {
+            if (state[root - n_base_tokens] != 0) continue;
+            state[root - n_base_tokens] = 1;
+            stack.emplace_back(root, 0);
+            while (!stack.empty()) {
+                auto& [token, next] = stack.back();
+                if (next == 2) {
+                    state[token - n_base_tokens] = 2;
+                    stack.pop_back();
+                    continue;
+                }
+                auto part = mapper.at(token)[next++];
+                if (part < n_base_tokens) continue;
+                if (state[part - n_base_tokens] == 1)
+                    throw std::runtime_error(
+                        "Model data has cyclic expansions of tokens");
+                if (state[part - n_base_tokens] == 0) {
+                    state[part - n_base_tokens] = 1;
+                    stack.emplace_back(part, 0);
+                }
+            }
+        }
+    }
+
+    /// @brief Write the model as a C++ header with its tables in arrays.
+    /// @param name Namespace in `ubpe::embedded` for the arrays and `model`,
+    /// the `EmbeddedModel` over them.
+    /// @param is_classic If the model is `UbpeClassic`.
+    /// @return Source of the header.
+    ///
+    /// Note: split settings are not embedded, so tokenizers with known words,
+    /// break tokens, stop tokens or a regex pattern are not supported.
+    std::string _embed(const std::string& name, bool is_classic) const {
+        if (this->tokens_weights.size() == 0 ||
+            this->tokens_backward_mapper.size() == 0)
+            throw std::logic_error("Tokenizer is not fitted");
+        bool has_pattern = false;
+        if constexpr (!std::is_same_v<OptionalPatternType<TokenType>,
+                                      std::monostate>) {
+            has_pattern = this->regex_pattern.has_value();
+        }
+        if (this->known_words.has_value() || this->break_tokens.has_value() ||
+            this->stop_tokens.has_value() || has_pattern)
+            throw std::invalid_argument(
+                "Tokenizers with split settings can not be embedded");
+        if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])) ||
+            !std::all_of(name.cbegin(), name.cend(), [](unsigned char c) {
+                return std::isalnum(c) || c == '_';
+            }))
+            throw std::invalid_argument("`name` should be an identifier");
+
+        using Model = EmbeddedModel<TokenType>;
+        HeaderWriter writer;
+        auto guard = "UBPE_EMBEDDED_" + name + "_HPP";
+        std::transform(guard.begin(), guard.end(), guard.begin(),
+                       [](unsigned char c) { return std::toupper(c); });
+        writer.line("// Tokenizer `" + name + "` embedded by `embed`.");
+        writer.line("#ifndef " + guard);
+        writer.line("#define " + guard);
+        writer.line();
+        writer.line("#include <cstdint>");
+        writer.line();
+        writer.line("#include \"embedding.hpp\"");
+        writer.line();
+        writer.line("namespace ubpe::embedded::" + name + " {");
+        writer.line();
+
+        // alphabet
+        std::vector<TokenType> symbols(this->alphabet.size());
+        std::vector<TokenType> sorted_symbols;
+        std::vector<std::uint32_t> sorted_indices;
+        for (const auto& [symbol, index] : this->alphabet) {
+            symbols.at(index) = symbol;
+            sorted_symbols.emplace_back(symbol);
+            sorted_indices.emplace_back(index);
+        }
+        writer.array("symbols", symbols);
+        writer.array("sorted_symbols", sorted_symbols);
+        writer.array("sorted_indices", sorted_indices);
+
+        // dense tables of tokens
+        std::size_t size = std::max<std::size_t>(
+            {this->alphabet.size(),
+             this->tokens_backward_mapper.crbegin()->first + std::size_t(1),
+             this->tokens_weights.crbegin()->first + std::size_t(1)});
+        std::vector<double> weights(size, 0.0);
+        for (const auto& [token, weight] : this->tokens_weights) {
+            weights[token] = weight;
+        }
+        std::vector<std::uint32_t> expansion_offsets = {0};
+        std::vector<std::uint32_t> expansions;
+        for (std::uint32_t token = 0; token < size; token++) {
+            // tokens of `UbpeClassic` expand to pairs of tokens, which are
+            // expanded further
+            auto it = this->tokens_backward_mapper.find(token);
+            std::vector<std::uint32_t> stack;
+            if (it != this->tokens_backward_mapper.end())
+                stack.assign(it->second.crbegin(), it->second.crend());
+            while (!stack.empty()) {
+                auto current = stack.back();
+                stack.pop_back();
+                it = this->tokens_backward_mapper.find(current);
+                if (!is_classic || it == this->tokens_backward_mapper.end()) {
+                    expansions.emplace_back(current);
+                } else {
+                    stack.insert(stack.end(), it->second.crbegin(),
+                                 it->second.crend());
+                }
+            }
+            expansion_offsets.emplace_back(expansions.size());
+        }
+        writer.array("weights", weights);
+        writer.array("expansion_offsets", expansion_offsets);
+        writer.array("expansions", expansions);
+        std::vector<std::string> fields = {"symbols", "sorted_symbols",
+                                           "sorted_indices", "weights",
+                                           "expansion_offsets", "expansions"};
+
+        if (!is_classic) {
+            // trie with the same tokens as the lookup automaton of `Ubpe`
+            std::vector<std::map<std::uint32_t, std::uint32_t>> children(1);
+            std::vector<std::uint32_t> values = {Model::NONE};
+            auto insert = [&children, &values](
+                              const std::vector<std::uint32_t>& key,
+                              std::uint32_t value) {
+                if (value == Model::NONE)
+                    throw std::invalid_argument(
+                        "Symbol can not be embedded, as it marks missing "
+                        "tokens");
+                std::uint32_t state = 0;
+                for (const auto& symbol : key) {
+                    auto next = static_cast<std::uint32_t>(children.size());
+                    auto [it, is_new] =
+                        children[state].try_emplace(symbol, next);
+                    state = it->second;
+                    if (is_new) {
+                        children.emplace_back();
+                        values.emplace_back(Model::NONE);
+                    }
+                }
+                if (values[state] == Model::NONE) values[state] = value;
+            };
+            for (const auto& [token, index] : this->alphabet) {
+                insert({index}, token);
+            }
+            for (const auto& [index, tokens] : this->tokens_backward_mapper) {
+                insert(tokens, index);
+            }
+
+            std::vector<std::uint32_t> offsets = {0}, trie_symbols, targets;
+            for (const auto& edges : children) {
+                for (const auto& [symbol, target] : edges) {
+                    trie_symbols.emplace_back(symbol);
+                    targets.emplace_back(target);
+                }
+                offsets.emplace_back(targets.size());
+            }
+            writer.array("trie_offsets", offsets);
+            writer.array("trie_symbols", trie_symbols);
+            writer.array("trie_targets", targets);
+            writer.array("trie_values", values);
+            fields.insert(fields.end(), {"trie_offsets", "trie_symbols",
+                                         "trie_targets", "trie_values"});
+        } else {
+            // ranks of pairs as in the cache of `UbpeClassic`
+            std::map<std::uint64_t, std::uint32_t> ranks;
+            std::vector<std::uint32_t> pairs, merged;
+            std::vector<std::vector<std::uint32_t>> occurrences;
+            for (const auto& [token, pair] : this->tokens_backward_mapper) {
+                auto rank = static_cast<std::uint32_t>(merged.size());
+                pairs.insert(pairs.end(), {pair[0], pair[1]});
+                merged.emplace_back(token);
+                ranks.try_emplace(Model::pack(pair[0], pair[1]), rank);
+                for (std::size_t k = 0; k < 2; k++) {
+                    if (k == 1 && pair[1] == pair[0]) break;
+                    if (pair[k] >= occurrences.size())
+                        occurrences.resize(pair[k] + 1);
+                    occurrences[pair[k]].emplace_back(rank);
+                }
+            }
+
+            std::vector<std::uint64_t> pair_keys;
+            std::vector<std::uint32_t> pair_ranks;
+            for (const auto& [key, rank] : ranks) {
+                pair_keys.emplace_back(key);
+                pair_ranks.emplace_back(rank);
+            }
+            std::vector<std::uint32_t> offsets = {0}, occurrence_ranks;
+            for (const auto& token_ranks : occurrences) {
+                occurrence_ranks.insert(occurrence_ranks.end(),
+                                        token_ranks.cbegin(),
+                                        token_ranks.cend());
+                offsets.emplace_back(occurrence_ranks.size());
+            }
+            writer.array("pair_keys", pair_keys);
+            writer.array("pair_ranks", pair_ranks);
+            writer.array("pairs", pairs);
+            writer.array("merged", merged);
+            writer.array("occurrence_offsets", offsets);
+            writer.array("occurrence_ranks", occurrence_ranks);
+            fields.insert(fields.end(),
+                          {"pair_keys", "pair_ranks", "pairs", "merged",
+                           "occurrence_offsets", "occurrence_ranks"});
+        }
+
+        writer.line();
+        writer.line(std::string("inline constexpr EmbeddedModel<") +
+                    cpp_type_name<TokenType>() + "> model{");
+        writer.line(std::string("    .is_classic = ") +
+                    (is_classic ? "true" : "false") + ",");
+        for (const auto& field : fields) {
+            writer.line("    ." + field + " = " + field + ",");
+        }
+        writer.line("};");
+        writer.line();
+        writer.line("}  // namespace ubpe::embedded::" + name);
+        writer.line();
+        writer.line("#endif  // " + guard);
+        return writer.str();
+    }
 
     /// @brief Function that rearranges found tokens according to their weights
     /// and trims dictionary of the tokenizer to be not greater than
@@ -72,8 +437,11 @@ class UbpeBase {
         auto min_token = static_cast<std::uint32_t>(
             this->alphabet.size() +
             (this->known_words.has_value() ? this->known_words->size() : 0));
+        // nothing is deleted if there are no more tokens than `n_tokens`
         auto to_delete_quantity =
-            this->tokens_weights.size() - n_tokens.value() + min_token;
+            this->tokens_weights.size() + min_token > n_tokens.value()
+                ? this->tokens_weights.size() + min_token - n_tokens.value()
+                : 0;
 
         // find tokens to delete
         std::set<std::uint32_t> to_delete;
@@ -219,15 +587,363 @@ class UbpeBase {
                       [&sub](auto& doc) { _replace_token_pairs(doc, sub); });
     }
 
+    /// @brief Function for replacing pair of adjacent tokens in each word of
+    /// documents split into words.
+    /// @param corpus Documents split into words.
+    /// @param sub A substitution map, as in the other overloads.
+    static void _replace_token_pairs(
+        std::vector<std::vector<std::vector<std::uint32_t>>>& corpus,
+        const std::unordered_map<
+            std::uint32_t, std::pair<std::uint32_t, std::uint32_t>>& sub) {
+        std::for_each(corpus.begin(), corpus.end(),
+                      [&sub](auto& doc) { _replace_token_pairs(doc, sub); });
+    }
+
+    /// @brief Function for replacing pair of adjacent tokens in each word of
+    /// weighted documents.
+    /// @param corpus Documents split into words with their weights.
+    /// @param sub A substitution map, as in the other overloads.
+    static void _replace_token_pairs(
+        WeightedCorpus<std::uint32_t>& corpus,
+        const std::unordered_map<
+            std::uint32_t, std::pair<std::uint32_t, std::uint32_t>>& sub) {
+        _replace_token_pairs(corpus.documents, sub);
+    }
+
+    /// @brief Function for replacing pair of adjacent tokens in each word of
+    /// a frozen table of unique words.
+    /// @param table Table of unique words.
+    /// @param sub A substitution map, as in the other overloads.
+    static void _replace_token_pairs(
+        WordTable<std::uint32_t>& table,
+        const std::unordered_map<
+            std::uint32_t, std::pair<std::uint32_t, std::uint32_t>>& sub) {
+        _replace_token_pairs(table.get_words(), sub);
+    }
+
+    /// @brief Number of tokens of the alphabet and known words.
+    std::uint32_t _n_base_tokens() const {
+        return static_cast<std::uint32_t>(
+            this->alphabet.size() +
+            (this->known_words.has_value() ? this->known_words->size() : 0));
+    }
+
+    /// @brief Forget fitted tokens, so the tokenizer may be fitted again.
+    ///
+    /// Note: caches for encoding are rebuilt by the next fit.
+    void _reset_fit() {
+        this->tokens_weights.clear();
+        this->tokens_forward_mapper.clear();
+        this->tokens_backward_mapper.clear();
+        this->word_table.reset();
+        this->merge_history.reset();
+    }
+
+    /// @brief Get the first merges of the last fit that make a tokenizer
+    /// with at most `n_tokens` tokens.
+    MergeHistory _merge_history_prefix(std::uint32_t n_tokens) const {
+        if (!this->merge_history.has_value())
+            throw std::logic_error(
+                "Merges are recorded only by fit, not by loading");
+        if (n_tokens <= this->merge_history->n_base_tokens)
+            throw std::invalid_argument(
+                "`n_tokens` must be greater than the number of base tokens");
+        // the last merges may make tokens that were dropped by rearranging
+        if (n_tokens > this->n_tokens)
+            throw std::invalid_argument(
+                "`n_tokens` must not be greater than the number of tokens");
+
+        MergeHistory prefix{.n_base_tokens = this->merge_history->n_base_tokens,
+                            .merges = {}};
+        auto size = std::min<std::size_t>(
+            this->merge_history->merges.size(),
+            n_tokens - this->merge_history->n_base_tokens);
+        prefix.merges.assign(this->merge_history->merges.cbegin(),
+                             this->merge_history->merges.cbegin() + size);
+        return prefix;
+    }
+
+    /// @brief Check that the tokenizer may be fitted.
+    void _check_can_fit(std::uint32_t n_candidates) const {
+        if (this->tokens_weights.size() != 0 ||
+            this->tokens_forward_mapper.size() != 0 ||
+            this->tokens_backward_mapper.size() != 0)
+            throw std::logic_error("Tokenizer can be fitted only once");
+
+        if (n_candidates == 0)
+            throw std::logic_error("`n_candidates` should not be 0");
+    }
+
+    /// @brief Split each document of `corpus` into words of base tokens.
+    std::vector<std::vector<std::vector<std::uint32_t>>> _split_corpus(
+        const std::vector<DocType>& corpus,
+        SplitMode::value_type split_mode) const {
+        std::vector<std::vector<std::vector<std::uint32_t>>> _corpus;
+        _corpus.reserve(corpus.size());
+        std::transform(corpus.cbegin(), corpus.cend(),
+                       std::back_inserter(_corpus),
+                       [this, &split_mode](const auto& doc) {
+                           return this->_get_split_pipeline()(doc, split_mode,
+                                                              false);
+                       });
+        return _corpus;
+    }
+
+    /// @brief Count pairs of adjacent tokens in `corpus` that may become
+    /// candidates for new tokens.
+    /// @param corpus Data to count pairs in.
+    /// @param n_candidates Number of most popular pairs to select candidates
+    /// from.
+    /// @param is_allowed Function of a pair of tokens that is `false` for
+    /// pairs that can not be candidates.
+    /// @return Counter that gives the same candidates as a counter of all
+    /// allowed pairs.
+    ///
+    /// Note: if `pair_memory_budget` is set, only the counts needed to select
+    /// candidates are returned, and the rest are spilled to disk.
+    template <typename Corpus, typename Predicate>
+    PairCounter<std::uint32_t> _count_pairs(const Corpus& corpus,
+                                            std::uint32_t n_candidates,
+                                            Predicate is_allowed) const {
+        if (!this->pair_memory_budget.has_value()) {
+            auto counter = PairCounter<std::uint32_t>(corpus);
+            if (this->max_token_length.has_value()) {
+                counter.erase_if([&is_allowed](const auto& pair) {
+                    return !is_allowed(pair);
+                });
+            }
+            return counter;
+        }
+
+        SpillingPairCounter<std::uint32_t> counter(
+            *this->pair_memory_budget,
+            this->spill_directory.empty()
+                ? std::filesystem::temp_directory_path()
+                : std::filesystem::path(this->spill_directory));
+        counter.update(corpus);
+        return counter.candidates(n_candidates, is_allowed);
+    }
+
+    /// @brief Check if fitting should stop early.
+    /// @param history Merges made so far.
+    /// @param started Start of the merge rounds of the fit.
+    ///
+    /// Note: a tokenizer without artificial tokens is not fitted, so fitting
+    /// never stops before the first merge round.
+    bool _should_stop(const MergeHistory& history,
+                      std::chrono::steady_clock::time_point started) const {
+        if (history.merges.empty()) return false;
+        if (this->cancellation_token != nullptr &&
+            this->cancellation_token->is_cancelled())
+            return true;
+        if (this->time_budget.has_value() &&
+            std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          started)
+                    .count() > *this->time_budget)
+            return true;
+        return this->stop_callback != nullptr &&
+               this->stop_callback(this->stop_context);
+    }
+
+    /// @brief Merge pairs of adjacent tokens in the words of `corpus` until
+    /// the tokenizer has `this.n_tokens` tokens.
+    /// @param corpus Documents split into words, or a frozen table of unique
+    /// words; words are modified in place.
+    /// @param n_documents Number of documents in the corpus.
+    /// @param n_candidates Number of most popular pairs of adjacent tokens to
+    /// be substituted with new ones.
+    /// @param logger Logger of the calling fit.
+    /// @return Merges in the order they were made.
+    template <typename Corpus>
+    MergeHistory _learn_merges(Corpus& corpus, std::size_t n_documents,
+                               std::uint32_t n_candidates,
+                               Logger& logger) const {
+        MergeHistory history{.n_base_tokens = this->_n_base_tokens(),
+                             .merges = {}};
+        auto max_token = history.n_base_tokens - 1;
+        // number of basic tokens each token expands to
+        std::vector<std::uint32_t> lengths(history.n_base_tokens, 1);
+
+        logger.info("Starting token building");
+        logger.progress(this->n_tokens, max_token + 1);
+        logger.progress.run();
+        auto started = std::chrono::steady_clock::now();
+        auto stopped = false;
+        // recursively fit tokenizer with `corpus`
+        while (max_token < this->n_tokens) {
+            stopped = this->_should_stop(history, started);
+            if (stopped) break;
+            // find number of occurences of each pair of adjacent tokens;
+            // pairs that make too long tokens are never candidates
+            auto pairs_counter = this->_count_pairs(
+                corpus, n_candidates, [this, &lengths](const auto& pair) {
+                    return !this->max_token_length.has_value() ||
+                           lengths[pair.first] + lengths[pair.second] <=
+                               *this->max_token_length;
+                });
+            // counting is the longest phase of a round
+            stopped = this->_should_stop(history, started);
+            if (stopped) break;
+            // find most frequent bytepairs, a.k.a. candidates
+            auto mc = pairs_counter.most_common(n_candidates);
+            if (mc.size() == 0) break;
+
+            // find a banch of new tokens
+            // first candidate is always added
+            std::vector<
+                std::pair<std::pair<std::uint32_t, std::uint32_t>, std::size_t>>
+                token_pairs = {mc[0]};
+            // all substituted tokens must be distinct,
+            // and `current_set` tracks these tokens
+            std::set<std::uint32_t> current_set = {mc[0].first.first,
+                                                   mc[0].first.second};
+
+            // check each of top candidates from the second one
+            for (std::size_t i = 1; i < mc.size(); i++) {
+                const auto& [pair2, freq2] = mc[i];
+
+                if (current_set.contains(pair2.first) ||
+                    current_set.contains(pair2.second)) {
+                    continue;
+                }
+                // check that border pairs are not better
+                auto good_to_add = true;
+                for (const auto& [pair1, _] : token_pairs) {
+                    good_to_add =
+                        pairs_counter({pair2.second, pair1.first}).second <
+                            freq2 &&
+                        pairs_counter({pair1.second, pair2.first}).second <
+                            freq2;
+
+                    if (!good_to_add) break;
+                }
+                // finally add candidate if it is good
+                if (good_to_add) {
+                    token_pairs.emplace_back(std::make_pair(pair2, freq2));
+                    current_set.insert({pair2.first, pair2.second});
+                }
+            }
+
+            // record a merge for each pair of tokens
+            std::unordered_map<std::uint32_t,
+                               std::pair<std::uint32_t, std::uint32_t>>
+                sub;
+            for (const auto& [pair, _] : token_pairs) {
+                max_token++;
+                // counts of tables of unique words are summed over words, so
+                // they may exceed the number of documents
+                auto documents =
+                    std::min(pairs_counter(pair).first, n_documents);
+                history.merges.push_back(
+                    {pair.first, pair.second,
+                     std::log((1.0 + n_documents) / (1.0 + documents))});
+                sub[pair.first] = {pair.second, max_token};
+                lengths.push_back(lengths[pair.first] + lengths[pair.second]);
+            }
+
+            // update words with new tokens
+            _replace_token_pairs(corpus, sub);
+            logger.progress.update(token_pairs.size());
+        }
+        logger.progress.stop();
+        if (stopped)
+            logger.info("Stopped early with " +
+                        std::to_string(history.merges.size()) +
+                        " artificial tokens");
+        return history;
+    }
+
+    /// @brief Make tokens of the tokenizer from `history`.
+    /// @param history Merges made by `learn_merges`.
+    /// @param is_classic If `tokens_backward_mapper` should store pairs
+    /// instead of the full expansions of the new tokens.
+    /// @param rearrange_tokens If tokens should be rearranged to make tokens
+    /// with smaller numbers be more valueable.
+    /// @param logger Logger of the calling fit.
+    ///
+    /// Note: caches for encoding are built by the caller.
+    void _apply_merges(const MergeHistory& history, bool is_classic,
+                       bool rearrange_tokens, Logger& logger) {
+        if (history.n_base_tokens != this->_n_base_tokens())
+            throw std::invalid_argument(
+                "Merges were made with another alphabet or known words");
+
+        auto token = history.n_base_tokens;
+        std::vector<std::uint32_t> lengths(history.n_base_tokens, 1);
+        for (const auto& merge : history.merges) {
+            if (merge.first >= token || merge.second >= token)
+                throw std::invalid_argument("Merge of unknown tokens");
+            lengths.push_back(lengths[merge.first] + lengths[merge.second]);
+            if (this->max_token_length.has_value() &&
+                lengths.back() > *this->max_token_length)
+                throw std::invalid_argument(
+                    "Merge makes a token longer than `max_token_length`");
+
+            this->tokens_weights[token] = merge.weight;
+            if (is_classic) {
+                this->tokens_backward_mapper[token] = {merge.first,
+                                                       merge.second};
+            } else {
+                // merge subsequences
+                std::vector<std::uint32_t> tokens_map;
+                for (const auto& part : {merge.first, merge.second}) {
+                    auto it = this->tokens_backward_mapper.find(part);
+                    if (it != this->tokens_backward_mapper.end()) {
+                        tokens_map.insert(tokens_map.end(),
+                                          it->second.cbegin(),
+                                          it->second.cend());
+                    } else {
+                        tokens_map.emplace_back(part);
+                    }
+                }
+                this->tokens_backward_mapper[token] = std::move(tokens_map);
+            }
+            token++;
+        }
+        this->merge_history = history;
+        // a fit stopped early or out of pairs makes fewer tokens than
+        // requested, and all of them are kept
+        this->n_tokens = std::min<std::uint32_t>(
+            this->n_tokens, history.n_base_tokens + history.merges.size());
+        logger.info("Built " +
+                    std::to_string(this->tokens_backward_mapper.size()) +
+                    " artificial tokens");
+
+        // rearrange fitted tokens
+        if (rearrange_tokens) {
+            this->_rearrange_tokens_by_weight(is_classic);
+            logger.info("Rearranged artificial tokens: " +
+                        std::to_string(this->tokens_backward_mapper.size()) +
+                        " left");
+        }
+
+        this->n_tokens =
+            this->_n_base_tokens() + this->tokens_backward_mapper.size();
+
+        std::transform(
+            this->tokens_backward_mapper.cbegin(),
+            this->tokens_backward_mapper.cend(),
+            std::inserter(this->tokens_forward_mapper,
+                          this->tokens_forward_mapper.end()),
+            [](const auto& mapper)
+                -> std::pair<std::vector<std::uint32_t>, std::uint32_t> {
+                return {mapper.second, mapper.first};
+            });
+    }
+
     /// @brief Convert document of `DocType` to vector of base tokens.
     /// @param doc Document, i.e. data of type `DocType`.
     /// @return Vector of base tokens.
     std::vector<std::uint32_t> _doc_to_vec(const DocType& doc) const {
         std::vector<std::uint32_t> tokens;
         tokens.reserve(doc.size());
-        std::transform(
-            doc.cbegin(), doc.cend(), std::back_inserter(tokens),
-            [this](const auto& element) { return this->alphabet.at(element); });
+        if (!map_symbols(doc.cbegin(), doc.cend(), this->alphabet,
+                         this->unknown_policy,
+                         this->unknown_policy == UnknownPolicy::REPLACE
+                             ? this->alphabet.at(*this->unknown_replacement)
+                             : 0,
+                         tokens))
+            throw std::out_of_range("Unknown symbol");
         return tokens;
     }
 
@@ -235,24 +951,28 @@ class UbpeBase {
     /// @param tokens Vector of base tokens.
     /// @return Document, i.e. data of type `DocType`.
     DocType _vec_to_doc(const std::vector<std::uint32_t>& tokens) const {
-        if (this->inverse_known_words.has_value()) {
-            DocType doc;
-            for (const auto& token : tokens) {
-                if (this->inverse_known_words->contains(token)) {
-                    const auto& word = this->inverse_known_words->at(token);
-                    doc.insert(doc.end(), word.cbegin(), word.cend());
-                } else {
-                    doc.emplace_back(this->inverse_alphabet.at(token));
+        this->_ensure_mappers();
+        DocType doc;
+        doc.reserve(tokens.size());
+        for (const auto& token : tokens) {
+            if (this->inverse_known_words.has_value()) {
+                auto word = this->inverse_known_words->find(token);
+                if (word != this->inverse_known_words->end()) {
+                    doc.insert(doc.end(), word->second.cbegin(),
+                               word->second.cend());
+                    continue;
                 }
             }
-            return doc;
+
+            auto symbol = this->inverse_alphabet.find(token);
+            if (symbol != this->inverse_alphabet.end()) {
+                doc.emplace_back(symbol->second);
+            } else if (this->unknown_policy == UnknownPolicy::REPLACE) {
+                doc.emplace_back(this->unknown_replacement.value());
+            } else if (this->unknown_policy == UnknownPolicy::RAISE) {
+                throw std::out_of_range("Unknown token");
+            }
         }
-        DocType doc;
-        doc.reserve(tokens.size());
-        std::transform(tokens.cbegin(), tokens.cend(), std::back_inserter(doc),
-                       [this](const auto& token) {
-                           return this->inverse_alphabet.at(token);
-                       });
         return doc;
     }
 
@@ -260,6 +980,70 @@ class UbpeBase {
     encode_word(std::vector<std::uint32_t> word,
                 std::uint8_t top_n = 1) const = 0;
 
+    /// @brief Build the cache for encoding of a subclass.
+    ///
+    /// Note: it may only read `alphabet`, `tokens_backward_mapper` and
+    /// `tokens_weights`, so that it can be built concurrently with other
+    /// derived structures.
+    virtual void _build_cache() const = 0;
+
+    /// @brief Build the inverse mappers if they are not built yet.
+    void _ensure_mappers() const {
+        this->mappers_built.call([this] {
+            // mappers loaded from JSON come with their inverses
+            if (this->inverse_alphabet.empty()) {
+                for (const auto& [token, index] : this->alphabet) {
+                    this->inverse_alphabet.emplace(index, token);
+                }
+            }
+            if (this->tokens_forward_mapper.empty()) {
+                for (const auto& [index, tokens] :
+                     this->tokens_backward_mapper) {
+                    this->tokens_forward_mapper.emplace(tokens, index);
+                }
+            }
+            if (this->known_words.has_value()) {
+                this->inverse_known_words.emplace();
+                for (const auto& [word, token] : this->known_words.value()) {
+                    this->inverse_known_words->emplace(token, word);
+                }
+            }
+        });
+    }
+
+    /// @brief Get the split pipeline, building it if it is not built yet.
+    const SplitPipeline<DocType, TokenType>& _get_split_pipeline() const {
+        this->split_pipeline_built.call([this] {
+            SplitPipelineConfig<DocType, TokenType> split_pipeline_config{};
+            if (this->known_words.has_value()) {
+                split_pipeline_config.known_words = this->known_words.value();
+            }
+            if (this->break_tokens.has_value()) {
+                split_pipeline_config.break_tokens =
+                    this->break_tokens.value();
+            }
+            if constexpr (!std::is_same_v<OptionalPatternType<TokenType>,
+                                          std::monostate>) {
+                split_pipeline_config.regex_pattern = this->regex_pattern;
+            }
+            if (this->stop_tokens.has_value()) {
+                split_pipeline_config.stop_tokens = this->stop_tokens.value();
+            }
+            this->split_pipeline = SplitPipeline<DocType, TokenType>(
+                this->alphabet, split_pipeline_config);
+        });
+        return this->split_pipeline;
+    }
+
+    /// @brief Build the cache for encoding if it is not built yet.
+    void _ensure_cache() const {
+        this->cache_built.call([this] { this->_build_cache(); });
+    }
+
+    /// Minimum number of tokens of a tokenizer to build its derived
+    /// structures in parallel in `warmup`.
+    static constexpr std::size_t PARALLEL_LOAD_MIN_TOKENS = 4096;
+
    public:
     UbpeBase(std::uint32_t n_tokens,
              std::map<TokenType, std::uint32_t> alphabet,
@@ -381,35 +1165,14 @@ class UbpeBase {
                 "`alphabet` and `inverse_alphabet` should be of the same "
                 "size.");
 
-        if (known_words.has_value()) {
-            this->inverse_known_words.emplace();
-            std::transform(
-                known_words->cbegin(), known_words->cend(),
-                std::inserter(*this->inverse_known_words,
-                              this->inverse_known_words->end()),
-                [](const auto& element) -> std::pair<std::uint32_t, DocType> {
-                    return {element.second, element.first};
-                });
-        }
-
-        SplitPipelineConfig<DocType, TokenType> split_pipeline_config{};
-        if (known_words.has_value()) {
-            split_pipeline_config.known_words = known_words.value();
-        }
-        if (break_tokens.has_value()) {
-            split_pipeline_config.break_tokens = break_tokens.value();
-        }
         if constexpr (!std::is_same_v<OptionalPatternType<TokenType>,
                                       std::monostate>) {
-            split_pipeline_config.regex_pattern = regex_pattern;
             this->regex_pattern = regex_pattern;
         }
-        if (stop_tokens.has_value()) {
-            split_pipeline_config.stop_tokens = stop_tokens.value();
-        }
-
-        this->split_pipeline =
-            SplitPipeline<DocType, TokenType>(alphabet, split_pipeline_config);
+        // derived structures are built on first use
+        this->mappers_built = LazyFlag();
+        this->split_pipeline_built = LazyFlag();
+        this->cache_built = LazyFlag();
     }
     UbpeBase(std::uint32_t n_tokens,
              std::map<TokenType, std::uint32_t> alphabet,
@@ -426,6 +1189,57 @@ class UbpeBase {
                    tokens_backward_mapper, tokens_weights, known_words,
                    break_tokens, std::nullopt, stop_tokens) {}
 
+    /// @brief Construct the tokenizer from its binary representation.
+    /// @param reader Reader of the data written by `_serialize`.
+    /// @param is_classic If the model is `UbpeClassic`.
+    UbpeBase(BinaryReader& reader, bool is_classic) {
+        for (const auto& c : {'U', 'B', 'P', 'E'}) {
+            if (reader.read<char>() != c)
+                throw std::runtime_error("Data is not a serialized tokenizer");
+        }
+        // version 1 is version 2 without the maximum token length
+        auto version = reader.read<std::uint8_t>();
+        if (version < 1 || version > SERIALIZATION_VERSION)
+            throw std::runtime_error("Unsupported version of serialized data");
+        if (reader.read<std::uint16_t>() != BYTE_ORDER_MARK)
+            throw std::runtime_error(
+                "Data was serialized on a machine with another byte order");
+        if (reader.read<std::uint8_t>() != is_classic)
+            throw std::runtime_error(
+                "Data was serialized by another tokenizer class");
+        if (reader.read<std::uint8_t>() != sizeof(TokenType))
+            throw std::runtime_error(
+                "Data was serialized by a tokenizer with another token type");
+
+        this->n_tokens = reader.read<std::uint32_t>();
+        this->alphabet = reader.read<std::map<TokenType, std::uint32_t>>();
+        this->tokens_backward_mapper =
+            reader.read<std::map<std::uint32_t, std::vector<std::uint32_t>>>();
+        this->tokens_weights = reader.read<std::map<std::uint32_t, double>>();
+        this->known_words =
+            reader.read<std::optional<std::map<DocType, std::uint32_t>>>();
+        this->break_tokens = reader.read<std::optional<std::set<TokenType>>>();
+        if constexpr (!std::is_same_v<OptionalPatternType<TokenType>,
+                                      std::monostate>) {
+            this->regex_pattern = reader.read<OptionalPatternType<TokenType>>();
+        } else {
+            if (reader.read<std::uint8_t>() != 0)
+                throw std::runtime_error(
+                    "Regex patterns are not supported for this token type");
+        }
+        this->stop_tokens = reader.read<std::optional<std::set<TokenType>>>();
+        if (version >= 2)
+            this->max_token_length =
+                reader.read<std::optional<std::uint32_t>>();
+        if (!reader.done())
+            throw std::runtime_error("Serialized data has unexpected tail");
+        this->_check_loaded(is_classic);
+        // derived structures are built on first use
+        this->mappers_built = LazyFlag();
+        this->split_pipeline_built = LazyFlag();
+        this->cache_built = LazyFlag();
+    }
+
     UbpeBase(const UbpeBase&) = default;
     UbpeBase(UbpeBase&&) = default;
     UbpeBase& operator=(const UbpeBase&) = default;
@@ -436,6 +1250,7 @@ class UbpeBase {
     /// @return `this.tokens_forward_mapper`
     std::map<std::vector<std::uint32_t>, std::uint32_t> getForwardMapper()
         const {
+        this->_ensure_mappers();
         return this->tokens_forward_mapper;
     }
 
@@ -452,6 +1267,12 @@ class UbpeBase {
         return this->tokens_weights;
     }
 
+    /// @brief Get merges made by the last fit.
+    /// @return `this.merge_history`, empty for loaded tokenizers.
+    const std::optional<MergeHistory>& getMergeHistory() const {
+        return this->merge_history;
+    }
+
     /// @brief Get alphabet mapping.
     /// @return Base alphabet mapping.
     std::map<TokenType, std::uint32_t> getAlphabet() const {
@@ -461,6 +1282,7 @@ class UbpeBase {
     /// @brief Get inverse alphabet mapping.
     /// @return Inverse abse alphabet mapping.
     std::map<std::uint32_t, TokenType> getInverseAlphabet() const {
+        this->_ensure_mappers();
         return this->inverse_alphabet;
     }
 
@@ -474,6 +1296,7 @@ class UbpeBase {
     /// @return Inverse known words mapping.
     std::optional<std::map<std::uint32_t, DocType>> getInverseKnownWords()
         const {
+        this->_ensure_mappers();
         return this->inverse_known_words;
     }
 
@@ -502,12 +1325,252 @@ class UbpeBase {
         return this->stop_tokens;
     }
 
+    /// @brief Write the model to a compact binary representation.
+    /// @return Binary representation of the model.
+    ///
+    /// Note: the representation is meant for transfering models between
+    /// processes, e.g. for pickling; use JSON dumps for long-term storage.
+    virtual std::string serialize() const = 0;
+
+    /// @brief Write the model as a C++ header with its tables in arrays, to
+    /// compile it into a binary and encode with `EmbeddedUbpe`.
+    /// @param name Namespace in `ubpe::embedded` for the arrays and `model`,
+    /// the `EmbeddedModel` over them; a C++ identifier.
+    /// @return Source of the header.
+    ///
+    /// Note: tokenizers with known words, break tokens, stop tokens or a
+    /// regex pattern can not be embedded.
+    virtual std::string embed(const std::string& name) const = 0;
+
+    /// @brief Set handling of symbols that are not in the alphabet when
+    /// documents are encoded, and of tokens that are not in the vocabulary
+    /// when they are decoded.
+    /// @param policy The policy.
+    /// @param replacement Symbol of the alphabet that replaces unknown symbols
+    /// and tokens, required for `UnknownPolicy::REPLACE`.
+    void set_unknown_policy(
+        UnknownPolicy policy,
+        std::optional<TokenType> replacement = std::nullopt) {
+        this->_get_split_pipeline();
+        this->split_pipeline.set_unknown_policy(policy, replacement);
+        this->unknown_policy = policy;
+        this->unknown_replacement =
+            policy == UnknownPolicy::REPLACE ? replacement : std::nullopt;
+    }
+
+    /// @brief Get handling of unknown symbols and tokens.
+    UnknownPolicy get_unknown_policy() const { return this->unknown_policy; }
+
+    /// @brief Limit the length of tokens made by the following fits.
+    /// @param max_token_length Maximum number of basic tokens, i.e. symbols
+    /// of the alphabet and known words, a new token may expand to; if
+    /// `std::nullopt`, tokens are not limited.
+    ///
+    /// Note: the depth of the search for tokens when encoding is the length
+    /// of the longest token, so the limit bounds the cost of encoding per
+    /// basic token.
+    void set_max_token_length(std::optional<std::uint32_t> max_token_length) {
+        if (max_token_length.has_value() && max_token_length < 2)
+            throw std::invalid_argument(
+                "`max_token_length` must be greater than 1");
+        this->max_token_length = max_token_length;
+    }
+
+    /// @brief Get maximum length of new tokens.
+    /// @return Maximum length of new tokens, if limited.
+    std::optional<std::uint32_t> getMaxTokenLength() const {
+        return this->max_token_length;
+    }
+
+    /// @brief Limit memory for counts of pairs of adjacent tokens while
+    /// fitting.
+    /// @param memory_budget Maximum memory in bytes for counts of pairs,
+    /// beyond which counts are spilled to disk; if `std::nullopt`, all counts
+    /// are kept in memory.
+    /// @param directory Directory for spilled counts; the temporary directory
+    /// of the system if empty.
+    ///
+    /// Note: merges are the same as without the limit, but each merge round
+    /// writes the counts to disk and reads them back twice.
+    void set_pair_memory_budget(std::optional<std::size_t> memory_budget,
+                                const std::string& directory = "") {
+        if (memory_budget.has_value() &&
+            memory_budget < SpillingPairCounter<std::uint32_t>::BYTES_PER_PAIR)
+            throw std::invalid_argument(
+                "`memory_budget` is too small to count a single pair");
+        this->pair_memory_budget = memory_budget;
+        this->spill_directory = directory;
+    }
+
+    /// @brief Set a token to stop the following fits early.
+    /// @param token The token, shared with the code that cancels fitting; if
+    /// `nullptr`, fits can not be cancelled.
+    ///
+    /// Note: a stopped fit makes tokens from the merges made until the stop,
+    /// so the tokenizer is usable but has fewer tokens.
+    void set_cancellation_token(std::shared_ptr<CancellationToken> token) {
+        this->cancellation_token = std::move(token);
+    }
+
+    /// @brief Limit the duration of merge rounds of the following fits.
+    /// @param seconds Maximum duration in seconds, checked between merge
+    /// rounds and after counting pairs; if `std::nullopt`, it is not limited.
+    ///
+    /// Note: the first merge round is always made, so the duration may exceed
+    /// the limit by a round.
+    void set_time_budget(std::optional<double> seconds) {
+        if (seconds.has_value() && !(*seconds >= 0.0))
+            throw std::invalid_argument("`seconds` must be non-negative");
+        this->time_budget = seconds;
+    }
+
+    /// @brief Set a callback checked when a fit checks the cancellation
+    /// token; the fit stops early if it returns `true`.
+    /// @param callback The callback, or `nullptr` to remove it.
+    /// @param context Context passed to `callback`.
+    void set_stop_callback(StopCallback callback, void* context = nullptr) {
+        this->stop_callback = callback;
+        this->stop_context = context;
+    }
+
     /// @brief Get split pipeline.
     /// @return Split pipeline.
     SplitPipeline<DocType, TokenType> getSplitPipeline() const {
-        return this->split_pipeline;
+        return this->_get_split_pipeline();
+    }
+
+    /// @brief Build derived structures that loaded tokenizers otherwise build
+    /// on first use, e.g. for predictable latency of the first calls.
+    ///
+    /// Note: the structures are independent, so for large tokenizers they are
+    /// built concurrently.
+    void warmup() const {
+        auto policy =
+            this->tokens_backward_mapper.size() >= PARALLEL_LOAD_MIN_TOKENS &&
+                    std::thread::hardware_concurrency() > 1
+                ? std::launch::async
+                : std::launch::deferred;
+        auto mappers =
+            std::async(policy, [this] { this->_ensure_mappers(); });
+        auto split_pipeline =
+            std::async(policy, [this] { this->_get_split_pipeline(); });
+        this->_ensure_cache();
+        // rethrow errors of the other structures
+        mappers.get();
+        split_pipeline.get();
+    }
+
+    /// @brief Make merges of pairs of adjacent tokens in `corpus` without
+    /// fitting the tokenizer.
+    /// @param corpus Data to learn merges on.
+    /// @param n_candidates Number of most popular pairs of adjacent tokens to
+    /// be substituted with new ones.
+    /// @param split_mode Split mode to use for corpus splitting.
+    /// @param quiet Whether to suppress logging.
+    /// @return Merges to fit tokenizers with the same alphabet and known
+    /// words with `fit_merges`.
+    MergeHistory learn_merges(
+        const std::vector<DocType>& corpus, std::uint32_t n_candidates = 50,
+        SplitMode::value_type split_mode = SplitMode::FULL,
+        bool quiet = false) const {
+        return this->learn_merges(this->_split_corpus(corpus, split_mode),
+                                  n_candidates, quiet);
+    }
+    MergeHistory learn_merges(const std::vector<DocType>& corpus,
+                              std::uint32_t n_candidates,
+                              std::uint8_t split_mode, bool quiet) const {
+        return learn_merges(corpus, n_candidates,
+                            SplitMode::value_type(split_mode), quiet);
+    }
+
+    /// @brief Make merges of pairs of adjacent tokens in `corpus` without
+    /// fitting the tokenizer.
+    /// @param corpus Data to learn merges on.
+    /// @param n_candidates Number of most popular pairs of adjacent tokens to
+    /// be substituted with new ones.
+    /// @param quiet Whether to suppress logging.
+    /// @return Merges to fit tokenizers with the same alphabet and known
+    /// words with `fit_merges`.
+    ///
+    /// Note: Each document in `corpus` should be a vector of vectors of token
+    /// indices, i.e. already splitted and tokenized.
+    MergeHistory learn_merges(
+        std::vector<std::vector<std::vector<std::uint32_t>>> corpus,
+        std::uint32_t n_candidates = 50, bool quiet = false) const {
+        if (n_candidates == 0)
+            throw std::logic_error("`n_candidates` should not be 0");
+
+        auto logger =
+            Logger({.scope = "UbpeBase::learn_merges", .quiet = quiet},
+                   {.unit = "token"});
+        auto n_documents = corpus.size();
+        return this->_learn_merges(corpus, n_documents, n_candidates, logger);
+    }
+
+    /// @brief Make merges of pairs of adjacent tokens in weighted `corpus`
+    /// without fitting the tokenizer.
+    /// @param corpus Data to learn merges on.
+    /// @param weights Number of times to count each document of `corpus`,
+    /// e.g. to oversample some sources; documents with zero weight are
+    /// ignored.
+    /// @param n_candidates Number of most popular pairs of adjacent tokens to
+    /// be substituted with new ones.
+    /// @param split_mode Split mode to use for corpus splitting.
+    /// @param quiet Whether to suppress logging.
+    /// @return The same merges as for `corpus` with each document repeated
+    /// as many times as its weight.
+    MergeHistory learn_merges(
+        const std::vector<DocType>& corpus,
+        const std::vector<std::size_t>& weights,
+        std::uint32_t n_candidates = 50,
+        SplitMode::value_type split_mode = SplitMode::FULL,
+        bool quiet = false) const {
+        return this->learn_merges(this->_split_corpus(corpus, split_mode),
+                                  weights, n_candidates, quiet);
     }
 
+    /// @brief Make merges of pairs of adjacent tokens in weighted `corpus`
+    /// without fitting the tokenizer.
+    /// @param corpus Data to learn merges on.
+    /// @param weights Number of times to count each document of `corpus`.
+    /// @param n_candidates Number of most popular pairs of adjacent tokens to
+    /// be substituted with new ones.
+    /// @param quiet Whether to suppress logging.
+    /// @return The same merges as for `corpus` with each document repeated
+    /// as many times as its weight.
+    ///
+    /// Note: Each document in `corpus` should be a vector of vectors of token
+    /// indices, i.e. already splitted and tokenized.
+    MergeHistory learn_merges(
+        std::vector<std::vector<std::vector<std::uint32_t>>> corpus,
+        const std::vector<std::size_t>& weights,
+        std::uint32_t n_candidates = 50, bool quiet = false) const {
+        if (weights.size() != corpus.size())
+            throw std::invalid_argument(
+                "`weights` must have a weight for each document");
+        if (n_candidates == 0)
+            throw std::logic_error("`n_candidates` should not be 0");
+
+        auto logger =
+            Logger({.scope = "UbpeBase::learn_merges", .quiet = quiet},
+                   {.unit = "token"});
+        auto n_documents =
+            std::accumulate(weights.cbegin(), weights.cend(), std::size_t(0));
+        WeightedCorpus<std::uint32_t> weighted{std::move(corpus), weights};
+        return this->_learn_merges(weighted, n_documents, n_candidates,
+                                   logger);
+    }
+
+    /// @brief Fit tokenizer with merges made by `learn_merges`.
+    /// @param history Merges made by a tokenizer with the same alphabet and
+    /// known words, possibly of another kind.
+    /// @param rearrange_tokens If tokens should be rearranged to make tokens
+    /// with smaller numbers be more valueable.
+    /// @param quiet Whether to suppress logging.
+    virtual void fit_merges(const MergeHistory& history,
+                            bool rearrange_tokens = true,
+                            bool quiet = false) = 0;
+
     /// @brief Fit tokenizer with `corpus`.
     /// @param corpus Data to fit tokenizer with.
     /// @param n_candidates Number of most popular pairs of adjacent tokens to
@@ -543,6 +1606,233 @@ class UbpeBase {
         std::uint32_t n_candidates = 50, bool rearrange_tokens = true,
         bool quiet = false) = 0;
 
+    /// @brief Fit tokenizer with weighted `corpus`.
+    /// @param corpus Data to fit tokenizer with.
+    /// @param weights Number of times to count each document of `corpus`,
+    /// e.g. to oversample some sources; documents with zero weight are
+    /// ignored.
+    /// @param n_candidates Number of most popular pairs of adjacent tokens to
+    /// be substituted with new ones.
+    /// @param rearrange_tokens If tokens should be rearranged to make tokens
+    /// with smaller numbers be more valueable.
+    /// @param split_mode Split mode to use for corpus splitting.
+    /// @param quiet Whether to suppress logging.
+    ///
+    /// Note: the result is the same as of fit with each document repeated as
+    /// many times as its weight, but documents are neither copied nor counted
+    /// more than once.
+    void fit(const std::vector<DocType>& corpus,
+             const std::vector<std::size_t>& weights,
+             std::uint32_t n_candidates = 50, bool rearrange_tokens = true,
+             SplitMode::value_type split_mode = SplitMode::FULL,
+             bool quiet = false) {
+        this->_check_can_fit(n_candidates);
+        auto history = this->learn_merges(corpus, weights, n_candidates,
+                                          split_mode, quiet);
+        this->fit_merges(history, rearrange_tokens, quiet);
+    }
+    void fit(const std::vector<DocType>& corpus,
+             const std::vector<std::size_t>& weights,
+             std::uint32_t n_candidates, bool rearrange_tokens,
+             std::uint8_t split_mode, bool quiet) {
+        fit(corpus, weights, n_candidates, rearrange_tokens,
+            SplitMode::value_type(split_mode), quiet);
+    }
+
+    /// @brief Fit tokenizer with weighted `corpus`.
+    /// @param corpus Data to fit tokenizer with.
+    /// @param weights Number of times to count each document of `corpus`.
+    /// @param n_candidates Number of most popular pairs of adjacent tokens to
+    /// be substituted with new ones.
+    /// @param rearrange_tokens If tokens should be rearranged to make tokens
+    /// with smaller numbers be more valueable.
+    /// @param quiet Whether to suppress logging.
+    ///
+    /// Note: Each document in `corpus` should be a vector of vectors of token
+    /// indices, i.e. already splitted and tokenized.
+    void fit(std::vector<std::vector<std::vector<std::uint32_t>>> corpus,
+             const std::vector<std::size_t>& weights,
+             std::uint32_t n_candidates = 50, bool rearrange_tokens = true,
+             bool quiet = false) {
+        this->_check_can_fit(n_candidates);
+        auto history = this->learn_merges(std::move(corpus), weights,
+                                          n_candidates, quiet);
+        this->fit_merges(history, rearrange_tokens, quiet);
+    }
+
+    /// @brief Read files and split each document into words of base tokens.
+    /// @param reader Object that reads the files, e.g. `TextCodec`; its
+    /// `read_files(paths, by_lines, consume)` should pass each document to
+    /// `consume` as soon as it is read.
+    /// @param paths Paths to the files.
+    /// @param by_lines If each non-empty line is a separate document;
+    /// otherwise each file is a single document.
+    /// @param split_mode Split mode to use for documents splitting.
+    /// @return Corpus to fit the tokenizer with.
+    ///
+    /// Note: documents are split as soon as they are read, so the whole
+    /// corpus is kept only as words of base tokens.
+    template <typename Reader>
+    std::vector<std::vector<std::vector<std::uint32_t>>> split_files(
+        const Reader& reader, const std::vector<std::string>& paths,
+        bool by_lines = true,
+        SplitMode::value_type split_mode = SplitMode::FULL) const {
+        std::vector<std::vector<std::vector<std::uint32_t>>> corpus;
+        reader.read_files(paths, by_lines,
+                          [this, &corpus, &split_mode](DocType&& doc) {
+                              corpus.emplace_back(this->_get_split_pipeline()(
+                                  doc, split_mode, false));
+                          });
+        return corpus;
+    }
+    template <typename Reader>
+    std::vector<std::vector<std::vector<std::uint32_t>>> split_files(
+        const Reader& reader, const std::vector<std::string>& paths,
+        bool by_lines, std::uint8_t split_mode) const {
+        return split_files(reader, paths, by_lines,
+                           SplitMode::value_type(split_mode));
+    }
+
+    /// @brief Start fitting the tokenizer with a corpus that is passed in
+    /// chunks with `add_documents`.
+    void begin_fit() {
+        if (this->tokens_weights.size() != 0 ||
+            this->tokens_forward_mapper.size() != 0 ||
+            this->tokens_backward_mapper.size() != 0)
+            throw std::logic_error("Tokenizer can be fitted only once");
+
+        this->word_table.emplace();
+    }
+
+    /// @brief Add a chunk of documents to the corpus of the started fit.
+    /// @param chunk Documents to add.
+    /// @param split_mode Split mode to use for documents splitting.
+    ///
+    /// Note: each document is immediately reduced to its unique words, so
+    /// documents are not kept after the call.
+    void add_documents(const std::vector<DocType>& chunk,
+                       SplitMode::value_type split_mode = SplitMode::FULL) {
+        if (!this->word_table.has_value())
+            throw std::logic_error(
+                "Fit is not started, call `begin_fit` first");
+
+        for (const auto& doc : chunk) {
+            this->word_table->add_document(
+                this->_get_split_pipeline()(doc, split_mode, false));
+        }
+    }
+    void add_documents(const std::vector<DocType>& chunk,
+                       std::uint8_t split_mode) {
+        add_documents(chunk, SplitMode::value_type(split_mode));
+    }
+
+    /// @brief Add a chunk of documents to the corpus of the started fit.
+    /// @param chunk Documents to add.
+    ///
+    /// Note: Each document in `chunk` should be a vector of vectors of token
+    /// indices, i.e. already splitted and tokenized.
+    void add_documents(
+        const std::vector<std::vector<std::vector<std::uint32_t>>>& chunk) {
+        if (!this->word_table.has_value())
+            throw std::logic_error(
+                "Fit is not started, call `begin_fit` first");
+
+        for (const auto& doc : chunk) {
+            this->word_table->add_document(doc);
+        }
+    }
+
+    /// @brief Add unique words with precomputed counts to the corpus of the
+    /// started fit.
+    /// @param words Words with the numbers of their occurrences and of
+    /// documents they occur in.
+    /// @param n_documents Number of documents the counts were computed on.
+    /// @param split_mode Split mode to use for words splitting.
+    ///
+    /// Note: weights of new tokens are derived from the document counts of
+    /// the words, as they are for documents added with `add_documents`.
+    void add_word_counts(
+        const std::vector<
+            std::pair<DocType, std::pair<std::size_t, std::size_t>>>& words,
+        std::size_t n_documents,
+        SplitMode::value_type split_mode = SplitMode::FULL) {
+        if (!this->word_table.has_value())
+            throw std::logic_error(
+                "Fit is not started, call `begin_fit` first");
+
+        for (const auto& [word, counts] : words) {
+            this->word_table->add_word(
+                this->_get_split_pipeline()(word, split_mode, false),
+                counts.first, counts.second);
+        }
+        this->word_table->add_documents(n_documents);
+    }
+    void add_word_counts(
+        const std::vector<
+            std::pair<DocType, std::pair<std::size_t, std::size_t>>>& words,
+        std::size_t n_documents, std::uint8_t split_mode) {
+        add_word_counts(words, n_documents, SplitMode::value_type(split_mode));
+    }
+
+    /// @brief Add unique words with precomputed counts to the corpus of the
+    /// started fit.
+    /// @param words Words with the numbers of their occurrences and of
+    /// documents they occur in.
+    /// @param n_documents Number of documents the counts were computed on.
+    ///
+    /// Note: Each word in `words` should be a vector of vectors of token
+    /// indices, i.e. already splitted and tokenized.
+    void add_word_counts(
+        const std::vector<std::pair<std::vector<std::vector<std::uint32_t>>,
+                                    std::pair<std::size_t, std::size_t>>>&
+            words,
+        std::size_t n_documents) {
+        if (!this->word_table.has_value())
+            throw std::logic_error(
+                "Fit is not started, call `begin_fit` first");
+
+        for (const auto& [parts, counts] : words) {
+            this->word_table->add_word(parts, counts.first, counts.second);
+        }
+        this->word_table->add_documents(n_documents);
+    }
+
+    /// @brief Fit tokenizer with the documents passed to `add_documents`
+    /// since `begin_fit`.
+    /// @param n_candidates Number of most popular pairs of adjacent tokens to
+    /// be substituted with new ones.
+    /// @param rearrange_tokens If tokens should be rearranged to make tokens
+    /// with smaller numbers be more valueable.
+    /// @param quiet Whether to suppress logging.
+    ///
+    /// Note: document frequencies of pairs are summed over unique words, up to
+    /// the number of documents, so they may be greater than those that `fit`
+    /// finds on the same corpus when a pair occurs in several different words
+    /// of a document; weights of new tokens and the order of candidates with
+    /// equal counts of occurrences may differ then.
+    virtual void finish_fit(std::uint32_t n_candidates = 50,
+                            bool rearrange_tokens = true,
+                            bool quiet = false) = 0;
+
+    /// @brief Keep only the tokens made by the first merges of the last fit,
+    /// as if the tokenizer was fitted with `n_tokens` tokens.
+    /// @param n_tokens Maximum number of tokens to keep, at most the number
+    /// of tokens of the tokenizer.
+    /// @param rearrange_tokens If tokens should be rearranged to make tokens
+    /// with smaller numbers be more valueable.
+    /// @param quiet Whether to suppress logging.
+    ///
+    /// Note: the rest of the merges are forgotten, so a copy of the
+    /// tokenizer should be truncated to get several smaller tokenizers.
+    void truncate(std::uint32_t n_tokens, bool rearrange_tokens = true,
+                  bool quiet = false) {
+        auto history = this->_merge_history_prefix(n_tokens);
+        this->_reset_fit();
+        this->n_tokens = static_cast<std::uint32_t>(history.n_base_tokens +
+                                                    history.merges.size());
+        this->fit_merges(history, rearrange_tokens, quiet);
+    }
+
     /// @brief Rearrange tokens to make tokens with smaller numbers be more
     /// valueable.
     /// @param n_tokens Number of tokens to keep; if `std::nullopt`, keep all.
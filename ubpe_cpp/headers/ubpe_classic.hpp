@@ -1,6 +1,7 @@
 #ifndef UBPE_CLASSIC_CPP
 #define UBPE_CLASSIC_CPP
 
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
@@ -8,7 +9,9 @@
 #include <stdexcept>
 
 #include "counter.hpp"
+#include "flat_hash_map.hpp"
 #include "logger.hpp"
+#include "merge_history.hpp"
 #include "pair_counter.hpp"
 #include "ubpe_base.hpp"
 
@@ -18,71 +21,136 @@ namespace ubpe {
 template <DocumentT DocType, typename TokenType = typename DocType::value_type>
 class UbpeClassic : public UbpeBase<DocType, TokenType> {
    private:
-    std::vector<std::vector<std::uint32_t>> pairs;
-
-    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode_word(
-        std::vector<std::uint32_t> word,
-        std::uint8_t top_n = 1) const override {
-        // recursively encode
-        while (word.size() > 1) {
-            // generate adjacent pairs in `doc`
-            std::set<std::vector<std::uint32_t>> pairs;
-            std::transform(word.cbegin(), word.cend() - 1, word.cbegin() + 1,
-                           std::inserter(pairs, pairs.end()),
-                           [](const auto& left,
-                              const auto& right) -> std::vector<std::uint32_t> {
-                               return {left, right};
-                           });
-
-            // find the first most valueable pair of tokens in the `doc`
-            std::size_t i = 0;
-            while (i < this->pairs.size() && !pairs.contains(this->pairs[i]))
-                i++;
-
-            // if `i` is out of bounds, encoding is completed
-            if (i == this->pairs.size()) break;
-
-            // pairs of old tokens to be substituted
-            std::vector<std::vector<std::uint32_t>> tokens = {this->pairs[i]};
-            // all substituted tokens must be distinct,
-            // and `current_set` tracks these tokens
-            std::set<std::uint32_t> current_set(this->pairs[i].cbegin(),
-                                                this->pairs[i].cend());
-
-            // find pairs for replacement
-            for (std::size_t j = i + 1; j < this->pairs.size(); j++) {
-                // subsequence of most valueable pairs
-                if (current_set.contains(this->pairs[j][0]) ||
-                    current_set.contains(this->pairs[j][1])) {
-                    break;
-                }
-                // that can be interrapted by tokens that do not present in
-                // `doc`
-                if (pairs.contains(this->pairs[j])) {
-                    tokens.emplace_back(this->pairs[j]);
-                    current_set.insert(this->pairs[j].cbegin(),
-                                       this->pairs[j].cend());
-                }
+    mutable std::vector<std::vector<std::uint32_t>> pairs;
+    /// Tokens that substitute `pairs`.
+    mutable std::vector<std::uint32_t> merged;
+    /// Ranks of pairs of tokens in `pairs`, keyed by packed pairs.
+    mutable FlatHashMap<std::uint32_t> ranks;
+    /// Sorted ranks of the pairs that contain a token, indexed by tokens.
+    mutable std::vector<std::vector<std::uint32_t>> occurrences;
+
+    /// @brief Cache pairs of tokens, their ranks and the ranks of pairs that
+    /// contain each token for encoding.
+    void _build_pairs() const {
+        this->pairs.clear();
+        this->merged.clear();
+        this->ranks.clear();
+        this->occurrences.clear();
+        this->ranks.reserve(this->tokens_backward_mapper.size());
+        for (const auto& [token, pair] : this->tokens_backward_mapper) {
+            auto rank = static_cast<std::uint32_t>(this->pairs.size());
+            this->pairs.emplace_back(pair);
+            this->merged.emplace_back(token);
+            // the first rank of a pair is kept
+            this->ranks.try_emplace(
+                FlatHashMap<std::uint32_t>::pack(pair[0], pair[1]), rank);
+            for (std::size_t k = 0; k < 2; k++) {
+                if (k == 1 && pair[1] == pair[0]) break;
+                if (pair[k] >= this->occurrences.size())
+                    this->occurrences.resize(pair[k] + 1);
+                this->occurrences[pair[k]].emplace_back(rank);
             }
+        }
+    }
 
-            std::unordered_map<std::uint32_t,
-                               std::pair<std::uint32_t, std::uint32_t>>
-                sub;
-            std::transform(
-                tokens.cbegin(), tokens.cend(), std::inserter(sub, sub.end()),
-                [this](const auto& token)
-                    -> std::pair<std::uint32_t,
-                                 std::pair<std::uint32_t, std::uint32_t>> {
-                    return {token[0],
-                            {token[1], this->tokens_forward_mapper.at(token)}};
-                });
-
-            this->_replace_token_pairs(word, sub);
+    void _build_cache() const override { this->_build_pairs(); }
+
+    /// @brief Make tokens from `history` and cache pairs for encoding.
+    void _fit_merges(const MergeHistory& history, bool rearrange_tokens,
+                     Logger& logger) {
+        this->_apply_merges(history, true, rearrange_tokens, logger);
+
+        // cache pairs of tokens for encoding
+        this->_build_pairs();
+        logger.info("Cached pairs for faster encoding");
+    }
+
+    /// @brief Get the first rank after `rank` of a pair that contains
+    /// `token`, or the number of pairs if there is no such pair.
+    std::size_t _next_occurrence(std::uint32_t token, std::size_t rank) const {
+        const auto& token_ranks = this->occurrences[token];
+        auto it = std::upper_bound(token_ranks.cbegin(), token_ranks.cend(),
+                                   rank);
+        return it == token_ranks.cend() ? this->pairs.size() : *it;
+    }
+
+    /// @brief Hint the processor to load ranks of adjacent pairs in `word`.
+    void _prefetch_pairs(const std::vector<std::uint32_t>& word) const {
+        for (std::size_t i = 0; i + 1 < word.size(); i++) {
+            this->ranks.prefetch(
+                FlatHashMap<std::uint32_t>::pack(word[i], word[i + 1]));
         }
+    }
 
-        // compute weight of encoded `doc`
+    /// @brief Substitute the first most valueable pair of tokens in `word`
+    /// and the following pairs that can be substituted at the same time.
+    /// @param word Sequence of tokens, modified in place.
+    /// @param present Buffer for ranks of pairs in `word`.
+    /// @return `false` if no pair can be substituted, so encoding is
+    /// completed.
+    bool _merge_step(std::vector<std::uint32_t>& word,
+                     std::vector<std::uint32_t>& present) const {
+        if (word.size() < 2) return false;
+
+        // ranks of adjacent pairs in `word`
+        present.clear();
+        for (std::size_t i = 0; i + 1 < word.size(); i++) {
+            auto rank = this->ranks.find(
+                FlatHashMap<std::uint32_t>::pack(word[i], word[i + 1]));
+            if (rank != nullptr) present.emplace_back(*rank);
+        }
+        if (present.empty()) return false;
+        std::sort(present.begin(), present.end());
+        present.erase(std::unique(present.begin(), present.end()),
+                      present.end());
+
+        // all substituted tokens must be distinct, so pairs are taken in
+        // order of their ranks until the first pair (even one that is not
+        // present in `word`) that shares a token with the taken ones, and
+        // `limit` is the rank of that pair
+        std::unordered_map<std::uint32_t,
+                           std::pair<std::uint32_t, std::uint32_t>>
+            sub;
+        std::size_t limit = this->pairs.size();
+        for (const auto& rank : present) {
+            if (rank >= limit) break;
+            const auto& pair = this->pairs[rank];
+            sub[pair[0]] = {pair[1], this->merged[rank]};
+            limit = std::min({limit, this->_next_occurrence(pair[0], rank),
+                              this->_next_occurrence(pair[1], rank)});
+        }
+
+        this->_replace_token_pairs(word, sub);
+        return true;
+    }
+
+    /// @brief Substitute pairs of tokens in several words at once.
+    ///
+    /// Note: each round makes one step in every unfinished word, and ranks
+    /// for all of them are prefetched first, so lookups of different words
+    /// wait for memory at the same time rather than one after another.
+    void _merge_words(std::vector<std::vector<std::uint32_t>>& words) const {
+        std::vector<std::size_t> active;
+        for (std::size_t i = 0; i < words.size(); i++) {
+            if (words[i].size() > 1) active.emplace_back(i);
+        }
+
+        std::vector<std::uint32_t> present;
+        while (!active.empty()) {
+            for (const auto& i : active) this->_prefetch_pairs(words[i]);
+            std::size_t n_active = 0;
+            for (std::size_t k = 0; k < active.size(); k++) {
+                if (this->_merge_step(words[active[k]], present))
+                    active[n_active++] = active[k];
+            }
+            active.resize(n_active);
+        }
+    }
+
+    /// @brief Compute weight of an encoded word.
+    double _weight(const std::vector<std::uint32_t>& word) const {
         auto counter = Counter<std::uint32_t>(word);
-        double weight = std::accumulate(
+        return std::accumulate(
             counter.cbegin(), counter.cend(), 0.0,
             [this](double total, auto& element) {
                 double freq = element.second;
@@ -91,8 +159,50 @@ class UbpeClassic : public UbpeBase<DocType, TokenType> {
                                           this->tokens_weights.at(element.first)
                                     : 0.0);
             });
+    }
+
+    /// @brief Join encoded words of a document.
+    /// @param parts Words of the document.
+    /// @param encoded Encoded words, starting from the first word of `parts`.
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> _join_words(
+        const std::vector<std::vector<std::uint32_t>>& parts,
+        std::vector<std::vector<std::uint32_t>>::const_iterator encoded)
+        const {
+        // handle empty sequence
+        if (parts.empty()) return {{{}, 0.0}};
+        if (parts.size() == 1) return {{*encoded, this->_weight(*encoded)}};
+
+        std::vector<std::uint32_t> result;
+        double weight = 0.0;
+        for (const auto& word : parts) {
+            result.insert(result.end(), encoded->begin(), encoded->end());
+            // basic tokens that are words by themselves have no weight
+            if (word.size() != 1) weight += this->_weight(*encoded);
+            encoded++;
+        }
+
+        return {{result, weight}};
+    }
+
+    std::vector<std::pair<std::vector<std::uint32_t>, double>> encode_word(
+        std::vector<std::uint32_t> word,
+        std::uint8_t /*top_n*/ = 1) const override {
+        // recursively encode
+        std::vector<std::uint32_t> present;
+        while (this->_merge_step(word, present)) {
+        }
+
+        return {{word, this->_weight(word)}};
+    }
 
-        return {{word, weight}};
+    /// @brief Check that the tokenizer can encode with `top_n`.
+    void _check_encode(std::uint8_t top_n) const {
+        this->_ensure_cache();
+        if (this->pairs.size() == 0 || this->tokens_weights.size() == 0 ||
+            this->tokens_backward_mapper.size() == 0)
+            throw std::logic_error("Tokenizer is not fitted");
+        if (top_n < 1)
+            throw std::invalid_argument("top_n must be greater than 0");
     }
 
    public:
@@ -140,10 +250,6 @@ class UbpeClassic : public UbpeBase<DocType, TokenType> {
               n_tokens, alphabet, inverse_alphabet, tokens_forward_mapper,
               tokens_backward_mapper, tokens_weights, known_words, break_tokens,
               regex_pattern, stop_tokens) {
-        std::transform(tokens_backward_mapper.cbegin(),
-                       tokens_backward_mapper.cend(),
-                       std::back_inserter(this->pairs),
-                       [](const auto& element) { return element.second; });
     }
 
     UbpeClassic(std::uint32_t n_tokens,
@@ -161,10 +267,15 @@ class UbpeClassic : public UbpeBase<DocType, TokenType> {
                                        tokens_forward_mapper,
                                        tokens_backward_mapper, tokens_weights,
                                        known_words, break_tokens, stop_tokens) {
-        std::transform(tokens_backward_mapper.cbegin(),
-                       tokens_backward_mapper.cend(),
-                       std::back_inserter(this->pairs),
-                       [](const auto& element) { return element.second; });
+    }
+
+    /// @brief Construct the tokenizer from its binary representation.
+    /// @param data Data written by `serialize`.
+    /// @param size Size of `data` in bytes.
+    UbpeClassic(const char* data, std::size_t size)
+        : UbpeClassic(BinaryReader(data, size)) {}
+    UbpeClassic(BinaryReader reader)
+        : UbpeBase<DocType, TokenType>(reader, true) {
     }
 
     UbpeClassic(const UbpeClassic&) = default;
@@ -173,270 +284,89 @@ class UbpeClassic : public UbpeBase<DocType, TokenType> {
     UbpeClassic& operator=(UbpeClassic&&) = default;
     ~UbpeClassic() = default;
 
+    using UbpeBase<DocType, TokenType>::fit;
+
     void fit(const std::vector<DocType>& corpus,
              std::uint32_t n_candidates = 50, bool rearrange_tokens = true,
              SplitMode::value_type split_mode = SplitMode::FULL,
              bool quiet = false) override {
-        if (!this->pairs.empty() || this->tokens_weights.size() != 0 ||
-            this->tokens_forward_mapper.size() != 0 ||
-            this->tokens_backward_mapper.size() != 0)
-            throw std::logic_error("Tokenizer can be fitted only once");
+        this->_check_can_fit(n_candidates);
 
-        if (n_candidates == 0)
-            throw std::logic_error("`n_candidates` should not be 0");
-
-        auto logger = ubpe::Logger(
-            {.scope = "UbpeClassic::fit", .quiet = quiet}, {.unit = "token"});
+        auto logger = Logger({.scope = "UbpeClassic::fit", .quiet = quiet},
+                             {.unit = "token"});
         logger.info("Starting fitting process");
 
-        std::vector<std::vector<std::vector<std::uint32_t>>> _corpus;
-        _corpus.reserve(corpus.size());
-        std::transform(corpus.cbegin(), corpus.cend(),
-                       std::back_inserter(_corpus),
-                       [this, &split_mode](const auto& doc) {
-                           return this->split_pipeline(doc, split_mode, false);
-                       });
+        auto _corpus = this->_split_corpus(corpus, split_mode);
         logger.info("Loaded the corpus");
 
-        auto max_token =
-            static_cast<std::uint32_t>(this->alphabet.size() +
-                                       (this->known_words.has_value()
-                                            ? this->known_words->size()
-                                            : 0)) -
-            1;
-
-        logger.info("Starting token building");
-        logger.progress(this->n_tokens, max_token + 1);
-        logger.progress.run();
-        // recursively fit tokenizer with `corpus`
-        while (max_token < this->n_tokens) {
-            // find number of occurences of each pair of adjacent tokens
-            auto pairs_counter = PairCounter<std::uint32_t>(_corpus);
-            // find most frequent bytepairs, a.k.a. candidates
-            auto mc = pairs_counter.most_common(n_candidates);
-            if (mc.size() == 0) break;
-
-            // find a banch of new tokens
-            // first candidate is always added
-            std::vector<
-                std::pair<std::pair<std::uint32_t, std::uint32_t>, std::size_t>>
-                token_pairs = {mc[0]};
-            // all substituted tokens must be distinct,
-            // and `current_set` tracks these tokens
-            std::set<std::uint32_t> current_set = {mc[0].first.first,
-                                                   mc[0].first.second};
-
-            // check each of top candidates from the second one
-            for (std::size_t i = 1; i < mc.size(); i++) {
-                const auto& [pair2, freq2] = mc[i];
-
-                if (current_set.contains(pair2.first) ||
-                    current_set.contains(pair2.second)) {
-                    continue;
-                }
-                // check that border pairs are not better
-                auto good_to_add = true;
-                for (const auto& [pair1, _] : token_pairs) {
-                    good_to_add =
-                        pairs_counter({pair2.second, pair1.first}).second <
-                            freq2 &&
-                        pairs_counter({pair1.second, pair2.first}).second <
-                            freq2;
-
-                    if (!good_to_add) break;
-                }
-                // finally add candidate if it is good
-                if (good_to_add) {
-                    token_pairs.emplace_back(std::make_pair(pair2, freq2));
-                    current_set.insert({pair2.first, pair2.second});
-                }
-            }
-
-            // add new pair mapping
-            std::unordered_map<std::uint32_t,
-                               std::pair<std::uint32_t, std::uint32_t>>
-                sub;
-            for (const auto& [pair, _] : token_pairs) {
-                max_token++;
-                this->tokens_weights[max_token] = std::log(
-                    (1.0 + corpus.size()) / (1.0 + pairs_counter(pair).first));
-                this->tokens_backward_mapper[max_token] = {pair.first,
-                                                           pair.second};
-                sub[pair.first] = {pair.second, max_token};
-            }
-
-            // update `corpus` with new tokens
-            std::for_each(_corpus.begin(), _corpus.end(),
-                          [this, &sub](auto& doc) {
-                              this->_replace_token_pairs(doc, sub);
-                          });
-            logger.progress.update(token_pairs.size());
-        }
-        logger.progress.stop();
-        logger.info("Built " +
-                    std::to_string(this->tokens_backward_mapper.size()) +
-                    " artificial tokens");
-
-        // rearrange fitted tokens
-        if (rearrange_tokens) {
-            this->_rearrange_tokens_by_weight(true);
-            logger.info("Rearranged artificial tokens: " +
-                        std::to_string(this->tokens_backward_mapper.size()) +
-                        " left");
-        }
-
-        this->n_tokens =
-            this->alphabet.size() +
-            (this->known_words.has_value() ? this->known_words->size() : 0) +
-            this->tokens_backward_mapper.size();
-
-        std::transform(
-            this->tokens_backward_mapper.cbegin(),
-            this->tokens_backward_mapper.cend(),
-            std::inserter(this->tokens_forward_mapper,
-                          this->tokens_forward_mapper.end()),
-            [](const auto& mapper)
-                -> std::pair<std::vector<std::uint32_t>, std::uint32_t> {
-                return {mapper.second, mapper.first};
-            });
-
-        // cache pairs of tokens for encoding
-        std::transform(this->tokens_backward_mapper.cbegin(),
-                       this->tokens_backward_mapper.cend(),
-                       std::back_inserter(this->pairs),
-                       [](const auto& element) { return element.second; });
-        logger.info("Cached pairs for faster encoding");
+        this->_fit_merges(
+            this->_learn_merges(_corpus, corpus.size(), n_candidates, logger),
+            rearrange_tokens, logger);
     }
 
     void fit(std::vector<std::vector<std::vector<std::uint32_t>>> corpus,
              std::uint32_t n_candidates = 50, bool rearrange_tokens = true,
              bool quiet = false) override {
-        if (!this->pairs.empty() || this->tokens_weights.size() != 0 ||
-            this->tokens_forward_mapper.size() != 0 ||
-            this->tokens_backward_mapper.size() != 0)
-            throw std::logic_error("Tokenizer can be fitted only once");
+        this->_check_can_fit(n_candidates);
 
-        if (n_candidates == 0)
-            throw std::logic_error("`n_candidates` should not be 0");
-
-        auto logger = ubpe::Logger(
-            {.scope = "UbpeClassic::fit", .quiet = quiet}, {.unit = "token"});
+        auto logger = Logger({.scope = "UbpeClassic::fit", .quiet = quiet},
+                             {.unit = "token"});
         logger.info("Starting fitting process on splitted corpus");
 
-        auto max_token =
-            static_cast<std::uint32_t>(this->alphabet.size() +
-                                       (this->known_words.has_value()
-                                            ? this->known_words->size()
-                                            : 0)) -
-            1;
-
-        logger.info("Starting token building");
-        logger.progress(this->n_tokens, max_token + 1);
-        logger.progress.run();
-        // recursively fit tokenizer with `corpus`
-        while (max_token < this->n_tokens) {
-            // find number of occurences of each pair of adjacent tokens
-            auto pairs_counter = PairCounter<std::uint32_t>(corpus);
-            // find most frequent bytepairs, a.k.a. candidates
-            auto mc = pairs_counter.most_common(n_candidates);
-            if (mc.size() == 0) break;
-
-            // find a banch of new tokens
-            // first candidate is always added
-            std::vector<
-                std::pair<std::pair<std::uint32_t, std::uint32_t>, std::size_t>>
-                token_pairs = {mc[0]};
-            // all substituted tokens must be distinct,
-            // and `current_set` tracks these tokens
-            std::set<std::uint32_t> current_set = {mc[0].first.first,
-                                                   mc[0].first.second};
-
-            // check each of top candidates from the second one
-            for (std::size_t i = 1; i < mc.size(); i++) {
-                const auto& [pair2, freq2] = mc[i];
-
-                if (current_set.contains(pair2.first) ||
-                    current_set.contains(pair2.second)) {
-                    continue;
-                }
-                // check that border pairs are not better
-                auto good_to_add = true;
-                for (const auto& [pair1, _] : token_pairs) {
-                    good_to_add =
-                        pairs_counter({pair2.second, pair1.first}).second <
-                            freq2 &&
-                        pairs_counter({pair1.second, pair2.first}).second <
-                            freq2;
-
-                    if (!good_to_add) break;
-                }
-                // finally add candidate if it is good
-                if (good_to_add) {
-                    token_pairs.emplace_back(std::make_pair(pair2, freq2));
-                    current_set.insert({pair2.first, pair2.second});
-                }
-            }
+        auto n_documents = corpus.size();
+        this->_fit_merges(
+            this->_learn_merges(corpus, n_documents, n_candidates, logger),
+            rearrange_tokens, logger);
+    }
 
-            // add new pair mapping
-            std::unordered_map<std::uint32_t,
-                               std::pair<std::uint32_t, std::uint32_t>>
-                sub;
-            for (const auto& [pair, _] : token_pairs) {
-                max_token++;
-                this->tokens_weights[max_token] = std::log(
-                    (1.0 + corpus.size()) / (1.0 + pairs_counter(pair).first));
-                this->tokens_backward_mapper[max_token] = {pair.first,
-                                                           pair.second};
-                sub[pair.first] = {pair.second, max_token};
-            }
+    void finish_fit(std::uint32_t n_candidates = 50,
+                    bool rearrange_tokens = true, bool quiet = false) override {
+        if (!this->word_table.has_value())
+            throw std::logic_error(
+                "Fit is not started, call `begin_fit` first");
 
-            // update `corpus` with new tokens
-            std::for_each(corpus.begin(), corpus.end(),
-                          [this, &sub](auto& doc) {
-                              this->_replace_token_pairs(doc, sub);
-                          });
-            logger.progress.update(token_pairs.size());
-        }
-        logger.progress.stop();
-        logger.info("Built " +
-                    std::to_string(this->tokens_backward_mapper.size()) +
-                    " artificial tokens");
-
-        // rearrange fitted tokens
-        if (rearrange_tokens) {
-            this->_rearrange_tokens_by_weight(true);
-            logger.info("Rearranged artificial tokens: " +
-                        std::to_string(this->tokens_backward_mapper.size()) +
-                        " left");
-        }
+        if (n_candidates == 0)
+            throw std::logic_error("`n_candidates` should not be 0");
 
-        this->n_tokens =
-            this->alphabet.size() +
-            (this->known_words.has_value() ? this->known_words->size() : 0) +
-            this->tokens_backward_mapper.size();
+        auto logger =
+            Logger({.scope = "UbpeClassic::finish_fit", .quiet = quiet},
+                   {.unit = "token"});
+        logger.info("Starting fitting process on " +
+                    std::to_string(this->word_table->size()) +
+                    " unique words");
+
+        auto& table = *this->word_table;
+        table.freeze();
+        auto history = this->_learn_merges(table, table.documents(),
+                                           n_candidates, logger);
+        this->word_table.reset();
+        this->_fit_merges(history, rearrange_tokens, logger);
+    }
 
-        std::transform(
-            this->tokens_backward_mapper.cbegin(),
-            this->tokens_backward_mapper.cend(),
-            std::inserter(this->tokens_forward_mapper,
-                          this->tokens_forward_mapper.end()),
-            [](const auto& mapper)
-                -> std::pair<std::vector<std::uint32_t>, std::uint32_t> {
-                return {mapper.second, mapper.first};
-            });
+    void fit_merges(const MergeHistory& history, bool rearrange_tokens = true,
+                    bool quiet = false) override {
+        this->_check_can_fit(1);
 
-        // cache pairs of tokens for encoding
-        std::transform(this->tokens_backward_mapper.cbegin(),
-                       this->tokens_backward_mapper.cend(),
-                       std::back_inserter(this->pairs),
-                       [](const auto& element) { return element.second; });
-        logger.info("Cached pairs for faster encoding");
+        auto logger =
+            Logger({.scope = "UbpeClassic::fit_merges", .quiet = quiet});
+        logger.info("Starting fitting process with " +
+                    std::to_string(history.merges.size()) + " merges");
+        this->_fit_merges(history, rearrange_tokens, logger);
+    }
+
+    std::string serialize() const override {
+        return this->_serialize(true);
+    }
+
+    std::string embed(const std::string& name) const override {
+        return this->_embed(name, true);
     }
 
     void rearrange_tokens(std::optional<std::uint32_t> n_tokens,
                           bool quiet) override {
+        this->_ensure_mappers();
+        this->_ensure_cache();
         if (this->pairs.size() == 0 || this->tokens_weights.size() == 0 ||
-            this->tokens_forward_mapper.size() == 0 ||
             this->tokens_backward_mapper.size() == 0)
             throw std::logic_error("Tokenizer is not fitted");
 
@@ -471,11 +401,7 @@ class UbpeClassic : public UbpeBase<DocType, TokenType> {
             });
 
         // cache pairs of tokens for encoding
-        this->pairs.clear();
-        std::transform(this->tokens_backward_mapper.cbegin(),
-                       this->tokens_backward_mapper.cend(),
-                       std::back_inserter(this->pairs),
-                       [](const auto& element) { return element.second; });
+        this->_build_pairs();
         logger.info("Recached pairs for faster encoding");
     }
 
@@ -483,69 +409,84 @@ class UbpeClassic : public UbpeBase<DocType, TokenType> {
     std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
         const DocType& doc, std::uint8_t top_n,
         SplitMode::value_type split_mode) const override {
-        if (this->pairs.size() == 0 || this->tokens_weights.size() == 0 ||
-            this->tokens_forward_mapper.size() == 0 ||
-            this->tokens_backward_mapper.size() == 0)
-            throw std::logic_error("Tokenizer is not fitted");
-        if (top_n < 1)
-            throw std::invalid_argument("top_n must be greater than 0");
+        this->_check_encode(top_n);
 
         // handle empty sequence
         if (doc.size() == 0) return {};
 
-        auto parts = this->split_pipeline(doc, split_mode);
-        if (parts.empty()) return {{{}, 0.0}};
-        if (parts.size() == 1) return this->encode_word(parts[0]);
-
-        std::vector<std::uint32_t> result;
-        double weight = 0.0;
-        for (const auto& word : parts) {
-            if (word.size() == 1) {
-                result.emplace_back(word[0]);
-            } else {
-                auto [encoded_word, word_weight] = this->encode_word(word)[0];
-                result.insert(result.end(), encoded_word.begin(),
-                              encoded_word.end());
-                weight += word_weight;
-            }
-        }
-
-        return {{result, weight}};
+        return this->encode(this->_get_split_pipeline()(doc, split_mode),
+                            top_n);
     }
 
     std::vector<std::pair<std::vector<std::uint32_t>, double>> encode(
         const std::vector<std::vector<std::uint32_t>>& parts,
         std::uint8_t top_n = 1) const override {
-        if (this->pairs.size() == 0 || this->tokens_weights.size() == 0 ||
-            this->tokens_forward_mapper.size() == 0 ||
-            this->tokens_backward_mapper.size() == 0)
-            throw std::logic_error("Tokenizer is not fitted");
-        if (top_n < 1)
-            throw std::invalid_argument("top_n must be greater than 0");
+        this->_check_encode(top_n);
 
-        // handle empty sequence
-        if (parts.empty()) return {{{}, 0.0}};
-        if (parts.size() == 1) return this->encode_word(parts[0]);
+        auto words = parts;
+        this->_merge_words(words);
+        return this->_join_words(parts, words.cbegin());
+    }
 
-        std::vector<std::uint32_t> result;
-        double weight = 0.0;
-        for (const auto& word : parts) {
-            if (word.size() == 1) {
-                result.emplace_back(word[0]);
-            } else {
-                auto [encoded_word, word_weight] = this->encode_word(word)[0];
-                result.insert(result.end(), encoded_word.begin(),
-                              encoded_word.end());
-                weight += word_weight;
-            }
+    /// @brief Encode documents, substituting pairs in words of all of them at
+    /// once.
+    /// @param docs Documents to encode.
+    /// @param top_n Number of encodings to return for each document.
+    /// @param split_mode Split mode.
+    /// @return List of encoded documents with weights for each document, the
+    /// same as of `encode`.
+    std::vector<std::vector<std::pair<std::vector<std::uint32_t>, double>>>
+    encode_batch(const std::vector<DocType>& docs, std::uint8_t top_n = 1,
+                 SplitMode::value_type split_mode = SplitMode::FULL) const {
+        this->_check_encode(top_n);
+
+        std::vector<std::vector<std::vector<std::uint32_t>>> parts;
+        parts.reserve(docs.size());
+        for (const auto& doc : docs) {
+            parts.emplace_back(
+                doc.size() == 0
+                    ? std::vector<std::vector<std::uint32_t>>()
+                    : this->_get_split_pipeline()(doc, split_mode));
         }
+        auto results = this->encode_batch(parts, top_n);
+        // empty documents have no encodings, as in `encode`
+        for (std::size_t i = 0; i < docs.size(); i++) {
+            if (docs[i].size() == 0) results[i].clear();
+        }
+        return results;
+    }
 
-        return {{result, weight}};
+    /// @brief Encode documents, substituting pairs in words of all of them at
+    /// once.
+    /// @param docs Documents split into vectors of basic tokens.
+    /// @param top_n Number of encodings to return for each document.
+    /// @return List of encoded documents with weights for each document, the
+    /// same as of `encode`.
+    std::vector<std::vector<std::pair<std::vector<std::uint32_t>, double>>>
+    encode_batch(
+        const std::vector<std::vector<std::vector<std::uint32_t>>>& docs,
+        std::uint8_t top_n = 1) const {
+        this->_check_encode(top_n);
+
+        std::vector<std::vector<std::uint32_t>> words;
+        for (const auto& parts : docs) {
+            words.insert(words.end(), parts.cbegin(), parts.cend());
+        }
+        this->_merge_words(words);
+
+        std::vector<std::vector<std::pair<std::vector<std::uint32_t>, double>>>
+            results;
+        results.reserve(docs.size());
+        auto encoded = words.cbegin();
+        for (const auto& parts : docs) {
+            results.emplace_back(this->_join_words(parts, encoded));
+            encoded += static_cast<std::ptrdiff_t>(parts.size());
+        }
+        return results;
     }
 
     DocType decode(const std::vector<std::uint32_t>& tokens) const override {
-        if (this->pairs.size() == 0 || this->tokens_weights.size() == 0 ||
-            this->tokens_forward_mapper.size() == 0 ||
+        if (this->tokens_weights.size() == 0 ||
             this->tokens_backward_mapper.size() == 0)
             throw std::logic_error("Tokenizer is not fitted");
 
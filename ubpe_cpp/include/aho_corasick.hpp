@@ -0,0 +1,286 @@
+#ifndef AHO_CORASICK_HPP
+#define AHO_CORASICK_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "flat_hash_map.hpp"
+
+namespace ubpe {
+
+/// @brief Aho-Corasick automaton over sequences of tokens.
+///
+/// Finds all occurrences of all the keys in a sequence with a single
+/// left-to-right pass, in O(length of the sequence + number of occurrences).
+/// Transitions of the trie are stored in a single flat hash map keyed by
+/// `(state, symbol)` pairs, so several sequences can be searched at once with
+/// the next transitions prefetched (see `scan_batch`).
+///
+/// Note: keys are added with `insert`, and `build` must be called before
+/// searching.
+template <typename V>
+class AhoCorasick {
+   public:
+    /// Maximum number of texts read at once by `scan_batch`.
+    static constexpr std::size_t LANES = 8;
+    /// Minimum number of states of the same depth per thread to link them
+    /// in parallel in `build`.
+    static constexpr std::size_t PARALLEL_LEVEL_SIZE = 16384;
+
+   private:
+    static constexpr std::uint32_t NONE =
+        std::numeric_limits<std::uint32_t>::max();
+
+    struct State {
+        std::optional<V> value{};
+        std::uint32_t depth = 0;
+        std::uint32_t parent = 0;
+        std::uint32_t symbol = 0;
+        /// The longest proper suffix of the state that is a state as well.
+        std::uint32_t fail = 0;
+        /// The longest proper suffix of the state that is a key.
+        std::uint32_t output = NONE;
+    };
+
+    std::vector<State> states = {State()};
+    FlatHashMap<std::uint32_t> transitions;
+    std::size_t n_keys = 0;
+    bool built = true;
+
+    /// @brief Get the state after reading `symbol` in `state`, following
+    /// failure links if needed.
+    std::uint32_t next(std::uint32_t state, std::uint32_t symbol) const {
+        while (true) {
+            auto it = this->transitions.find(
+                FlatHashMap<std::uint32_t>::pack(state, symbol));
+            if (it != nullptr) return *it;
+            if (state == 0) return 0;
+            state = this->states[state].fail;
+        }
+    }
+
+    /// @brief Compute failure and output links of `level[begin:end]`.
+    /// @param level States of the same depth.
+    void link(const std::vector<std::uint32_t>& level, std::size_t begin,
+              std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            auto& current = this->states[level[i]];
+            current.fail = current.parent == 0
+                               ? 0
+                               : this->next(this->states[current.parent].fail,
+                                            current.symbol);
+            const auto& fail = this->states[current.fail];
+            current.output = current.fail == 0 ? NONE
+                             : fail.value.has_value() ? current.fail
+                                                      : fail.output;
+        }
+    }
+
+    /// @brief Report all the keys that end in `state`, the longest first.
+    /// @param end Position in the text after the last symbol read.
+    template <typename F>
+    void report(std::uint32_t state, std::size_t end, F& on_match) const {
+        auto match = this->states[state].value.has_value()
+                         ? state
+                         : this->states[state].output;
+        while (match != NONE) {
+            const auto& matched = this->states[match];
+            on_match(end - matched.depth,
+                     static_cast<std::size_t>(matched.depth),
+                     matched.value.value());
+            match = matched.output;
+        }
+    }
+
+   public:
+    AhoCorasick() = default;
+    AhoCorasick(const AhoCorasick&) = default;
+    AhoCorasick(AhoCorasick&&) = default;
+    AhoCorasick& operator=(const AhoCorasick&) = default;
+    AhoCorasick& operator=(AhoCorasick&&) = default;
+    ~AhoCorasick() = default;
+
+    /// @brief Check if the automaton has no keys.
+    bool empty() const { return this->n_keys == 0; }
+
+    /// @brief Number of keys in the automaton.
+    std::size_t size() const { return this->n_keys; }
+
+    /// @brief Add a key-value pair to the automaton.
+    /// @param key Non-empty sequence of tokens.
+    /// @param value Value for the key.
+    ///
+    /// Note: if the key is already present, its value is not changed.
+    void insert(const std::vector<std::uint32_t>& key, V value) {
+        if (key.empty()) throw std::invalid_argument("`key` is empty");
+
+        std::uint32_t state = 0;
+        for (const auto& symbol : key) {
+            const auto next_state =
+                static_cast<std::uint32_t>(this->states.size());
+            auto [it, is_new] = this->transitions.try_emplace(
+                FlatHashMap<std::uint32_t>::pack(state, symbol), next_state);
+            if (is_new) {
+                State child;
+                child.depth = this->states[state].depth + 1;
+                child.parent = state;
+                child.symbol = symbol;
+                this->states.emplace_back(std::move(child));
+            }
+            state = *it;
+        }
+        if (!this->states[state].value.has_value()) {
+            this->states[state].value = std::move(value);
+            this->n_keys++;
+        }
+        this->built = false;
+    }
+
+    /// @brief Compute failure and output links of the automaton.
+    void build() {
+        // process states in order of their depth, so the links of all the
+        // shorter suffixes are ready
+        std::vector<std::vector<std::uint32_t>> levels;
+        for (std::uint32_t state = 1; state < this->states.size(); state++) {
+            auto depth = this->states[state].depth;
+            if (levels.size() < depth) levels.resize(depth);
+            levels[depth - 1].emplace_back(state);
+        }
+
+        for (const auto& level : levels) {
+            std::size_t n_parts = std::min<std::size_t>(
+                level.size() / PARALLEL_LEVEL_SIZE,
+                std::max(1u, std::thread::hardware_concurrency()));
+            if (n_parts <= 1) {
+                this->link(level, 0, level.size());
+                continue;
+            }
+            // states of a level only read the links of shorter states, so
+            // parts of a level are linked concurrently
+            std::vector<std::future<void>> parts;
+            auto part_size = (level.size() + n_parts - 1) / n_parts;
+            for (std::size_t begin = part_size; begin < level.size();
+                 begin += part_size) {
+                parts.emplace_back(std::async(
+                    std::launch::async, [this, &level, begin, part_size] {
+                        this->link(level, begin,
+                                   std::min(begin + part_size, level.size()));
+                    }));
+            }
+            this->link(level, 0, part_size);
+            for (auto& part : parts) part.get();
+        }
+        this->built = true;
+    }
+
+    /// @brief Find the longest key that starts at `start` in `text`.
+    /// @param text Sequence of tokens to search in.
+    /// @param start Position in `text` to search from.
+    /// @return Length and value of the key, or `std::nullopt` if no key
+    /// starts at `start`.
+    ///
+    /// Note: only the trie is walked, so the automaton need not be built.
+    std::optional<std::pair<std::size_t, V>> longest_prefix(
+        const std::vector<std::uint32_t>& text, std::size_t start) const {
+        std::optional<std::pair<std::size_t, V>> result = std::nullopt;
+        std::uint32_t state = 0;
+        for (std::size_t i = start; i < text.size(); i++) {
+            auto it = this->transitions.find(
+                FlatHashMap<std::uint32_t>::pack(state, text[i]));
+            if (it == nullptr) break;
+            state = *it;
+            if (this->states[state].value.has_value())
+                result = {i + 1 - start, this->states[state].value.value()};
+        }
+        return result;
+    }
+
+    /// @brief Find all occurrences of the keys in `text`.
+    /// @param text Sequence of tokens to search in.
+    /// @param on_match Function called as `on_match(start, length, value)`
+    /// for each occurrence; occurrences are reported in order of their ends,
+    /// and the longest first for the same end.
+    template <typename F>
+    void scan(const std::vector<std::uint32_t>& text, F&& on_match) const {
+        if (!this->built)
+            throw std::logic_error("Automaton is not built, call `build`");
+
+        std::uint32_t state = 0;
+        for (std::size_t i = 0; i < text.size(); i++) {
+            state = this->next(state, text[i]);
+            this->report(state, i + 1, on_match);
+        }
+    }
+
+    /// @brief Find all occurrences of the keys in each of `texts`.
+    /// @param texts Sequences of tokens to search in.
+    /// @param on_match Function called as
+    /// `on_match(index, start, length, value)` for each occurrence in
+    /// `texts[index]`; occurrences in each text are reported in the same
+    /// order as by `scan`.
+    ///
+    /// Note: up to `LANES` texts are read in lockstep, and the transition
+    /// each of them needs next is prefetched, so lookups of different texts
+    /// wait for memory at the same time rather than one after another.
+    template <typename F>
+    void scan_batch(const std::vector<std::vector<std::uint32_t>>& texts,
+                    F&& on_match) const {
+        if (!this->built)
+            throw std::logic_error("Automaton is not built, call `build`");
+
+        struct Lane {
+            std::size_t index;
+            std::size_t position;
+            std::uint32_t state;
+        };
+        std::vector<Lane> lanes;
+        lanes.reserve(LANES);
+
+        std::size_t next_text = 0;
+        while (true) {
+            // start new texts in free lanes
+            for (; lanes.size() < LANES && next_text < texts.size();
+                 next_text++) {
+                if (texts[next_text].empty()) continue;
+                lanes.push_back({next_text, 0, 0});
+                this->transitions.prefetch(FlatHashMap<std::uint32_t>::pack(
+                    0, texts[next_text][0]));
+            }
+            if (lanes.empty()) break;
+
+            for (std::size_t l = 0; l < lanes.size();) {
+                auto& lane = lanes[l];
+                const auto& text = texts[lane.index];
+                lane.state = this->next(lane.state, text[lane.position++]);
+                auto on_lane_match = [&on_match, &lane](std::size_t start,
+                                                        std::size_t length,
+                                                        const V& value) {
+                    on_match(lane.index, start, length, value);
+                };
+                this->report(lane.state, lane.position, on_lane_match);
+
+                if (lane.position == text.size()) {
+                    // the text is finished, free the lane
+                    lane = lanes.back();
+                    lanes.pop_back();
+                } else {
+                    this->transitions.prefetch(FlatHashMap<std::uint32_t>::pack(
+                        lane.state, text[lane.position]));
+                    l++;
+                }
+            }
+        }
+    }
+};
+
+}  // namespace ubpe
+
+#endif  // AHO_CORASICK_HPP
@@ -0,0 +1,50 @@
+#ifndef CANCELLATION_HPP
+#define CANCELLATION_HPP
+
+#include <atomic>
+
+namespace ubpe {
+
+/// @brief Callback that is checked while fitting with the context passed
+/// along with it; fitting stops early if it returns `true`.
+///
+/// Note: it is used by bindings, e.g. to stop fitting on signals of the
+/// interpreter.
+using StopCallback = bool (*)(void* context);
+
+/// @brief Flag to stop a running fit, e.g. from another thread or a signal
+/// handler.
+///
+/// Fitting stops at the next check between merge rounds, and the merges made
+/// until then make a usable tokenizer.
+class CancellationToken {
+   private:
+    std::atomic<bool> cancelled{false};
+
+   public:
+    CancellationToken() = default;
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken(CancellationToken&&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+    CancellationToken& operator=(CancellationToken&&) = delete;
+    ~CancellationToken() = default;
+
+    /// @brief Request to stop fitting.
+    void cancel() noexcept {
+        this->cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    /// @brief Withdraw the request, so the token may be used for another fit.
+    void reset() noexcept {
+        this->cancelled.store(false, std::memory_order_relaxed);
+    }
+
+    /// @brief Check if stopping was requested.
+    bool is_cancelled() const noexcept {
+        return this->cancelled.load(std::memory_order_relaxed);
+    }
+};
+
+}  // namespace ubpe
+
+#endif  // CANCELLATION_HPP
@@ -0,0 +1,166 @@
+#ifndef EMBEDDING_HPP
+#define EMBEDDING_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <limits>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace ubpe {
+
+/// @brief Tables of a fitted tokenizer laid out in flat arrays, so that a
+/// model can be compiled into a binary and used without loading.
+///
+/// Tokens index the dense tables directly. Tables of the other class are
+/// empty: the trie is used by `Ubpe` models, and pairs by `UbpeClassic`
+/// models.
+///
+/// Note: headers with the arrays are made by `embed` of tokenizers, and
+/// `EmbeddedUbpe` encodes with them.
+template <typename TokenType>
+struct EmbeddedModel {
+    /// Marks trie states that are not tokens.
+    static constexpr std::uint32_t NONE =
+        std::numeric_limits<std::uint32_t>::max();
+
+    bool is_classic = false;
+    /// Symbols of the alphabet indexed by basic tokens.
+    std::span<const TokenType> symbols{};
+    /// Symbols of the alphabet in increasing order, with their basic tokens.
+    std::span<const TokenType> sorted_symbols{};
+    std::span<const std::uint32_t> sorted_indices{};
+    /// Weights of tokens indexed by tokens; missing tokens weigh nothing.
+    std::span<const double> weights{};
+    /// Basic tokens of artificial tokens: the expansion of token `t` is
+    /// `expansions[expansion_offsets[t]:expansion_offsets[t + 1]]`, empty for
+    /// basic tokens.
+    std::span<const std::uint32_t> expansion_offsets{};
+    std::span<const std::uint32_t> expansions{};
+    /// Trie of all the tokens: the children of state `s` are
+    /// `trie_targets[trie_offsets[s]:trie_offsets[s + 1]]` with symbols in
+    /// increasing order in `trie_symbols`, and `trie_values[s]` is the token
+    /// of the state or `NONE`; the root is state 0.
+    std::span<const std::uint32_t> trie_offsets{};
+    std::span<const std::uint32_t> trie_symbols{};
+    std::span<const std::uint32_t> trie_targets{};
+    std::span<const std::uint32_t> trie_values{};
+    /// Pairs of tokens packed by `pack` in increasing order, with their first
+    /// ranks.
+    std::span<const std::uint64_t> pair_keys{};
+    std::span<const std::uint32_t> pair_ranks{};
+    /// Pairs of tokens by rank, two tokens per rank, and their substitutes.
+    std::span<const std::uint32_t> pairs{};
+    std::span<const std::uint32_t> merged{};
+    /// Sorted ranks of the pairs that contain token `t`:
+    /// `occurrence_ranks[occurrence_offsets[t]:occurrence_offsets[t + 1]]`.
+    std::span<const std::uint32_t> occurrence_offsets{};
+    std::span<const std::uint32_t> occurrence_ranks{};
+
+    /// @brief Pack a pair of tokens into a key of `pair_keys`.
+    static constexpr std::uint64_t pack(std::uint32_t first,
+                                        std::uint32_t second) {
+        return (static_cast<std::uint64_t>(first) << 32) | second;
+    }
+};
+
+/// @brief Get the name of `T` in C++ source.
+template <typename T>
+constexpr const char* cpp_type_name() {
+    if constexpr (std::is_same_v<T, char>)
+        return "char";
+    else if constexpr (std::is_same_v<T, wchar_t>)
+        return "wchar_t";
+    else if constexpr (std::is_same_v<T, char8_t>)
+        return "char8_t";
+    else if constexpr (std::is_same_v<T, char16_t>)
+        return "char16_t";
+    else if constexpr (std::is_same_v<T, char32_t>)
+        return "char32_t";
+    else if constexpr (std::is_same_v<T, double>)
+        return "double";
+    else if constexpr (std::is_signed_v<T>)
+        return sizeof(T) == 1   ? "std::int8_t"
+               : sizeof(T) == 2 ? "std::int16_t"
+               : sizeof(T) == 4 ? "std::int32_t"
+                                : "std::int64_t";
+    else
+        return sizeof(T) == 1   ? "std::uint8_t"
+               : sizeof(T) == 2 ? "std::uint16_t"
+               : sizeof(T) == 4 ? "std::uint32_t"
+                                : "std::uint64_t";
+}
+
+/// @brief Writer of a C++ header with arrays of a tokenizer model.
+class HeaderWriter {
+   private:
+    std::ostringstream out;
+
+    /// @brief Get `value` as a C++ literal of its type.
+    template <typename T>
+    static std::string literal(T value) {
+        std::ostringstream literal;
+        if constexpr (std::is_floating_point_v<T>) {
+            if (!std::isfinite(value))
+                throw std::invalid_argument("Weights should be finite");
+            // hexadecimal literals keep weights exact
+            literal << std::hexfloat << value;
+        } else if constexpr (std::is_signed_v<T>) {
+            auto number = static_cast<long long>(value);
+            // the minimum has no literal, as its negation overflows
+            if (number == std::numeric_limits<long long>::min())
+                literal << "(" << number + 1 << " - 1)";
+            else
+                literal << number;
+        } else {
+            literal << static_cast<unsigned long long>(value);
+            if constexpr (sizeof(T) == 8) literal << "u";
+        }
+        return literal.str();
+    }
+
+   public:
+    /// Maximum length of lines with values of arrays.
+    static constexpr std::size_t LINE_LENGTH = 80;
+
+    HeaderWriter() = default;
+
+    /// @brief Write a line of source.
+    void line(const std::string& text = "") { this->out << text << '\n'; }
+
+    /// @brief Write an array definition.
+    /// @param name Name of the array.
+    /// @param values Values of the array, not empty.
+    template <typename T>
+    void array(const std::string& name, const std::vector<T>& values) {
+        if (values.empty())
+            throw std::invalid_argument("Arrays should not be empty");
+        this->out << "inline constexpr " << cpp_type_name<T>() << " " << name
+                  << "[] = {";
+        std::size_t length = LINE_LENGTH;
+        for (std::size_t i = 0; i < values.size(); i++) {
+            auto text =
+                literal(values[i]) + (i + 1 < values.size() ? "," : "};");
+            if (length + text.size() + 1 > LINE_LENGTH) {
+                this->out << "\n   ";
+                length = 3;
+            }
+            this->out << " " << text;
+            length += text.size() + 1;
+        }
+        this->out << '\n';
+    }
+
+    /// @brief Get the header.
+    std::string str() const { return this->out.str(); }
+};
+
+}  // namespace ubpe
+
+#endif  // EMBEDDING_HPP
@@ -0,0 +1,129 @@
+#ifndef FLAT_HASH_MAP_HPP
+#define FLAT_HASH_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace ubpe {
+
+/// @brief Hash map from 64-bit keys to values with open addressing.
+///
+/// Keys and values are stored together in a single array probed linearly, so
+/// the slot that a lookup starts from is known in advance and can be loaded
+/// into cache with `prefetch` while other work is done.
+///
+/// Note: the maximum 64-bit value is reserved to mark empty slots and can not
+/// be used as a key.
+template <typename V>
+class FlatHashMap {
+   public:
+    static constexpr std::uint64_t EMPTY =
+        std::numeric_limits<std::uint64_t>::max();
+
+    /// @brief Combine two 32-bit values into a key.
+    static constexpr std::uint64_t pack(std::uint32_t first,
+                                        std::uint32_t second) {
+        return (static_cast<std::uint64_t>(first) << 32) | second;
+    }
+
+   private:
+    std::vector<std::pair<std::uint64_t, V>> slots;
+    std::size_t n = 0;
+
+    /// @brief Get the slot that a lookup of `key` starts from.
+    std::size_t home(std::uint64_t key) const {
+        return static_cast<std::size_t>(splitmix64(key)) &
+               (this->slots.size() - 1);
+    }
+
+    /// @brief Reallocate slots, keeping the load factor below 1/2.
+    void rehash(std::size_t capacity) {
+        auto old_slots = std::move(this->slots);
+        this->slots.assign(capacity, {EMPTY, V()});
+        for (auto& [key, value] : old_slots) {
+            if (key == EMPTY) continue;
+            auto slot = this->home(key);
+            while (this->slots[slot].first != EMPTY)
+                slot = (slot + 1) & (capacity - 1);
+            this->slots[slot] = {key, std::move(value)};
+        }
+    }
+
+   public:
+    FlatHashMap() = default;
+    FlatHashMap(const FlatHashMap&) = default;
+    FlatHashMap(FlatHashMap&&) = default;
+    FlatHashMap& operator=(const FlatHashMap&) = default;
+    FlatHashMap& operator=(FlatHashMap&&) = default;
+    ~FlatHashMap() = default;
+
+    /// @brief Number of keys in the map.
+    std::size_t size() const { return this->n; }
+
+    /// @brief Check if the map has no keys.
+    bool empty() const { return this->n == 0; }
+
+    /// @brief Remove all the keys.
+    void clear() {
+        this->slots.clear();
+        this->n = 0;
+    }
+
+    /// @brief Allocate slots for at least `count` keys.
+    void reserve(std::size_t count) {
+        std::size_t capacity = 16;
+        while (capacity < 2 * count) capacity *= 2;
+        if (capacity > this->slots.size()) this->rehash(capacity);
+    }
+
+    /// @brief Add a key-value pair if the key is not present.
+    /// @return Pointer to the value of `key`, and `true` if it was added.
+    std::pair<V*, bool> try_emplace(std::uint64_t key, V value) {
+        if (key == EMPTY) throw std::invalid_argument("`key` is reserved");
+        if (2 * (this->n + 1) > this->slots.size()) this->reserve(this->n + 1);
+
+        auto slot = this->home(key);
+        while (this->slots[slot].first != EMPTY) {
+            if (this->slots[slot].first == key)
+                return {&this->slots[slot].second, false};
+            slot = (slot + 1) & (this->slots.size() - 1);
+        }
+        this->slots[slot] = {key, std::move(value)};
+        this->n++;
+        return {&this->slots[slot].second, true};
+    }
+
+    /// @brief Get the value of `key`.
+    /// @return Pointer to the value, or `nullptr` if `key` is not present.
+    const V* find(std::uint64_t key) const {
+        if (this->slots.empty()) return nullptr;
+        auto slot = this->home(key);
+        while (this->slots[slot].first != EMPTY) {
+            if (this->slots[slot].first == key)
+                return &this->slots[slot].second;
+            slot = (slot + 1) & (this->slots.size() - 1);
+        }
+        return nullptr;
+    }
+
+    /// @brief Hint the processor to load the slot that a lookup of `key`
+    /// starts from; does nothing for compilers without the builtin.
+    void prefetch(std::uint64_t key) const {
+#if defined(__GNUC__) || defined(__clang__)
+        if (!this->slots.empty())
+            __builtin_prefetch(&this->slots[this->home(key)]);
+#else
+        (void)key;
+#endif
+    }
+};
+
+}  // namespace ubpe
+
+#endif  // FLAT_HASH_MAP_HPP
@@ -0,0 +1,67 @@
+#ifndef LAZY_FLAG_HPP
+#define LAZY_FLAG_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace ubpe {
+
+/// @brief Flag for thread-safe construction of a structure on its first use.
+///
+/// Unlike `std::once_flag`, the flag can be copied along with the structure
+/// it guards: a copy is set if the original is set, so copies of built
+/// structures are not built again.
+///
+/// Note: if construction throws, the flag is not set and the next use
+/// constructs the structure again.
+class LazyFlag {
+   private:
+    std::unique_ptr<std::once_flag> flag = std::make_unique<std::once_flag>();
+    mutable std::atomic<bool> done{false};
+
+   public:
+    LazyFlag() = default;
+    /// @brief Constructor.
+    /// @param done If the structure is already constructed.
+    explicit LazyFlag(bool done) {
+        if (done) this->set();
+    }
+    LazyFlag(const LazyFlag& other) : LazyFlag(other.is_set()) {}
+    LazyFlag(LazyFlag&& other) : LazyFlag(other.is_set()) {}
+    LazyFlag& operator=(const LazyFlag& other) {
+        if (this != &other) {
+            this->flag = std::make_unique<std::once_flag>();
+            this->done.store(false, std::memory_order_relaxed);
+            if (other.is_set()) this->set();
+        }
+        return *this;
+    }
+    LazyFlag& operator=(LazyFlag&& other) { return *this = other; }
+    ~LazyFlag() = default;
+
+    /// @brief Run `construct` unless it or another call has already
+    /// completed; concurrent calls wait for the one that runs.
+    template <typename F>
+    void call(F&& construct) const {
+        if (this->done.load(std::memory_order_acquire)) return;
+        std::call_once(*this->flag, [this, &construct] {
+            construct();
+            this->done.store(true, std::memory_order_release);
+        });
+    }
+
+    /// @brief Mark the structure as constructed.
+    void set() {
+        this->call([] {});
+    }
+
+    /// @brief Check if the structure is constructed.
+    bool is_set() const {
+        return this->done.load(std::memory_order_acquire);
+    }
+};
+
+}  // namespace ubpe
+
+#endif  // LAZY_FLAG_HPP
@@ -0,0 +1,31 @@
+#ifndef MERGE_HISTORY_HPP
+#define MERGE_HISTORY_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace ubpe {
+
+/// @brief Pair of adjacent tokens merged into a new token.
+struct Merge {
+    std::uint32_t first;
+    std::uint32_t second;
+    /// Weight of the new token, i.e. inverse document frequency of the pair
+    /// when it was merged.
+    double weight;
+};
+
+/// @brief Merges made while fitting a tokenizer, in the order they were made.
+///
+/// The `i`-th merge makes token `n_base_tokens + i`. Merges do not depend on
+/// the kind of the tokenizer, so a single run of merge rounds may fit both
+/// `Ubpe` and `UbpeClassic` with the same alphabet and known words.
+struct MergeHistory {
+    /// Number of tokens of the alphabet and known words.
+    std::uint32_t n_base_tokens = 0;
+    std::vector<Merge> merges;
+};
+
+}  // namespace ubpe
+
+#endif  // MERGE_HISTORY_HPP
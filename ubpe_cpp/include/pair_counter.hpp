@@ -11,9 +11,18 @@
 
 #include "heapq.hpp"
 #include "utils.hpp"
+#include "word_table.hpp"
 
 namespace ubpe {
 
+/// @brief Documents split into words, where each document is counted as many
+/// times as its weight.
+template <std::integral T>
+struct WeightedCorpus {
+    std::vector<std::vector<std::vector<T>>> documents;
+    std::vector<std::size_t> weights;
+};
+
 /// @brief Class for counting of occurences of adjacent pairs in the corpus.
 template <std::integral T>
 class PairCounter {
@@ -24,6 +33,25 @@ class PairCounter {
                        PairHash<T>>
         counter;
 
+    /// @brief Update the counter with adjacent pairs in a word counted
+    /// `occurrences` times in `documents` documents.
+    /// @param unique_pairs Scratch set reused between words.
+    void _update_word(
+        const std::vector<T>& word, std::size_t occurrences,
+        std::size_t documents,
+        std::unordered_set<std::pair<T, T>, PairHash<T>>& unique_pairs) {
+        if (word.size() < 2) return;
+
+        unique_pairs.clear();
+        for (std::size_t i = 0; i < word.size() - 1; i++) {
+            this->counter[{word[i], word[i + 1]}].second += occurrences;
+            unique_pairs.insert({word[i], word[i + 1]});
+        }
+        for (const auto& pair : unique_pairs) {
+            this->counter[pair].first += documents;
+        }
+    }
+
    public:
     /// @brief Constructor that updates the PairCounter instance with adjacent
     /// pairs in `doc`.
@@ -51,6 +79,22 @@ class PairCounter {
         }
     }
 
+    /// @brief Constructor that updates the PairCounter instance with adjacent
+    /// pairs in each document of `corpus` weighted by the document's weight.
+    /// @param corpus Documents split into words with their weights.
+    PairCounter(const WeightedCorpus<T>& corpus) {
+        for (std::size_t i = 0; i < corpus.documents.size(); i++) {
+            // pairs of dropped documents must not be candidates
+            if (corpus.weights[i] == 0) continue;
+            this->update(corpus.documents[i], corpus.weights[i]);
+        }
+    }
+
+    /// @brief Constructor that updates the PairCounter instance with adjacent
+    /// pairs in each word of `table` weighted by the word's counts.
+    /// @param table Table of unique words.
+    PairCounter(const WordTable<T>& table) { this->update(table); }
+
     PairCounter() = default;
     PairCounter(const PairCounter&) = default;
     PairCounter(PairCounter&&) = default;
@@ -81,14 +125,16 @@ class PairCounter {
 
     /// @brief Update PairCounter instance with adjacent pairs in `doc`;
     /// @param doc Vector of vectors.
-    void update(const std::vector<std::vector<T>>& doc) {
+    /// @param weight Number of times to count `doc`.
+    void update(const std::vector<std::vector<T>>& doc,
+                std::size_t weight = 1) {
         // update with unique adjacent pairs
         std::unordered_set<std::pair<T, T>, PairHash<T>> unique_pairs;
 
         // update with adjacent pairs
         for (const auto& word : doc) {
             for (std::size_t i = 0; i < word.size() - 1; i++) {
-                this->counter[{word[i], word[i + 1]}].second++;
+                this->counter[{word[i], word[i + 1]}].second += weight;
             }
 
             std::transform(
@@ -100,10 +146,67 @@ class PairCounter {
         }
 
         for (const auto& pair : unique_pairs) {
-            this->counter[pair].first++;
+            this->counter[pair].first += weight;
         }
     }
 
+    /// @brief Update PairCounter instance with adjacent pairs in each word of
+    /// `table`: each pair is counted as many times as the word occurred, and
+    /// in as many documents as the word occurred in.
+    /// @param table Table of unique words.
+    ///
+    /// Note: document counts of a pair are summed over the distinct words it
+    /// occurs in, so they are an upper bound of the exact counts and may
+    /// exceed the number of documents.
+    void update(const WordTable<T>& table) {
+        const auto& words = table.get_words();
+        const auto& counts = table.get_counts();
+        std::unordered_set<std::pair<T, T>, PairHash<T>> unique_pairs;
+        for (std::size_t wi = 0; wi < words.size(); wi++) {
+            const auto& [docs, occurrences] = counts[wi];
+            this->_update_word(words[wi], occurrences, docs, unique_pairs);
+        }
+    }
+
+    /// @brief Update PairCounter instance with adjacent pairs in a word of a
+    /// table of unique words.
+    /// @param word The word.
+    /// @param occurrences Number of times the word occurred.
+    /// @param documents Number of documents the word occurred in.
+    void update_word(const std::vector<T>& word, std::size_t occurrences,
+                     std::size_t documents) {
+        std::unordered_set<std::pair<T, T>, PairHash<T>> unique_pairs;
+        this->_update_word(word, occurrences, documents, unique_pairs);
+    }
+
+    /// @brief Add counts of `pair` counted elsewhere.
+    /// @param pair Pair of elements.
+    /// @param counts Number of documents and number of occurences of `pair`.
+    void add(const std::pair<T, T>& pair,
+             const std::pair<std::size_t, std::size_t>& counts) {
+        auto& total = this->counter[pair];
+        total.first += counts.first;
+        total.second += counts.second;
+    }
+
+    /// @brief Number of distinct pairs.
+    std::size_t size() const { return this->counter.size(); }
+
+    /// @brief Remove all the pairs.
+    void clear() { this->counter.clear(); }
+
+    auto cbegin() const { return this->counter.cbegin(); }
+    auto cend() const { return this->counter.cend(); }
+
+    /// @brief Remove pairs for which `predicate` returns `true`.
+    /// @param predicate Function of a pair of tokens.
+    template <typename Predicate>
+    void erase_if(Predicate predicate) {
+        std::erase_if(this->counter, [&predicate](const auto& item) {
+            return predicate(item.first);
+        });
+    }
+
     /// @brief Get `n` most common pairs.
     /// @param n How many pairs together with it's number of occurrences.
     std::vector<std::pair<std::pair<T, T>, std::size_t>> most_common(
@@ -0,0 +1,169 @@
+#ifndef SERIALIZATION_HPP
+#define SERIALIZATION_HPP
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <ranges>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ubpe {
+
+/// @brief Type that is written to a binary stream as is.
+template <typename T>
+concept ScalarT = std::is_arithmetic_v<T>;
+
+/// @brief Writer of a compact binary representation of tokenizer models.
+///
+/// Note: scalars are written in host byte order, so the data is meant for
+/// transfering models between processes, not for long-term storage.
+class BinaryWriter {
+   private:
+    std::string buffer;
+
+   public:
+    BinaryWriter() = default;
+
+    /// @brief Write a scalar.
+    template <ScalarT T>
+    void write(const T& value) {
+        const auto offset = this->buffer.size();
+        this->buffer.resize(offset + sizeof(T));
+        std::memcpy(this->buffer.data() + offset, &value, sizeof(T));
+    }
+
+    /// @brief Write a sequence of scalars prefixed with its length.
+    template <std::ranges::range Sequence>
+        requires ScalarT<typename Sequence::value_type>
+    void write(const Sequence& sequence) {
+        using T = typename Sequence::value_type;
+        this->write(static_cast<std::uint64_t>(sequence.size()));
+        if constexpr (std::is_same_v<Sequence, std::vector<T>> ||
+                      std::is_same_v<Sequence, std::basic_string<T>>) {
+            const auto offset = this->buffer.size();
+            this->buffer.resize(offset + sequence.size() * sizeof(T));
+            std::memcpy(this->buffer.data() + offset, sequence.data(),
+                        sequence.size() * sizeof(T));
+        } else {
+            for (const auto& value : sequence) this->write(value);
+        }
+    }
+
+    /// @brief Write a map prefixed with its size.
+    template <typename K, typename V>
+    void write(const std::map<K, V>& map) {
+        this->write(static_cast<std::uint64_t>(map.size()));
+        for (const auto& [key, value] : map) {
+            this->write(key);
+            this->write(value);
+        }
+    }
+
+    /// @brief Write an optional value prefixed with its presence flag.
+    template <typename T>
+    void write(const std::optional<T>& value) {
+        this->write(static_cast<std::uint8_t>(value.has_value()));
+        if (value.has_value()) this->write(value.value());
+    }
+
+    /// @brief Get written data.
+    const std::string& data() const { return this->buffer; }
+};
+
+/// @brief Reader of the data written by `BinaryWriter`.
+///
+/// Note: the reader does not own the data; throws `std::runtime_error` if
+/// the data ends unexpectedly.
+class BinaryReader {
+   private:
+    const char* data;
+    std::size_t size;
+    std::size_t position = 0;
+
+    /// @brief Check that `n` more bytes can be read.
+    void require(std::size_t n) const {
+        if (n > this->size - this->position)
+            throw std::runtime_error("Model data is truncated");
+    }
+
+    /// @brief Read the length of a sequence and check that it fits the data.
+    std::size_t read_length(std::size_t element_size) {
+        auto length = this->read<std::uint64_t>();
+        if (length > (this->size - this->position) / element_size)
+            throw std::runtime_error("Model data is truncated");
+        return static_cast<std::size_t>(length);
+    }
+
+   public:
+    BinaryReader(const char* data, std::size_t size) : data(data), size(size) {}
+
+    /// @brief Read a scalar.
+    template <ScalarT T>
+    T read() {
+        this->require(sizeof(T));
+        T value;
+        std::memcpy(&value, this->data + this->position, sizeof(T));
+        this->position += sizeof(T);
+        return value;
+    }
+
+    /// @brief Read a sequence of scalars prefixed with its length.
+    template <std::ranges::range Sequence>
+        requires ScalarT<typename Sequence::value_type>
+    Sequence read() {
+        using T = typename Sequence::value_type;
+        auto length = this->read_length(sizeof(T));
+        Sequence sequence;
+        if constexpr (std::is_same_v<Sequence, std::vector<T>> ||
+                      std::is_same_v<Sequence, std::basic_string<T>>) {
+            sequence.resize(length);
+            std::memcpy(sequence.data(), this->data + this->position,
+                        length * sizeof(T));
+            this->position += length * sizeof(T);
+        } else {
+            for (std::size_t i = 0; i < length; i++)
+                sequence.insert(sequence.end(), this->read<T>());
+        }
+        return sequence;
+    }
+
+    /// @brief Read a map prefixed with its size.
+    template <typename Map>
+        requires std::is_same_v<
+            Map, std::map<typename Map::key_type, typename Map::mapped_type>>
+    Map read() {
+        // each element takes at least one byte
+        auto length = this->read_length(1);
+        Map map;
+        for (std::size_t i = 0; i < length; i++) {
+            auto key = this->read<typename Map::key_type>();
+            auto value = this->read<typename Map::mapped_type>();
+            map.emplace_hint(map.end(), std::move(key), std::move(value));
+        }
+        return map;
+    }
+
+    /// @brief Read an optional value prefixed with its presence flag.
+    template <typename Optional>
+        requires std::is_same_v<Optional,
+                                std::optional<typename Optional::value_type>>
+    Optional read() {
+        if (this->read<std::uint8_t>() == 0) return std::nullopt;
+        return this->read<typename Optional::value_type>();
+    }
+
+    /// @brief Check if all the data is read.
+    bool done() const { return this->position == this->size; }
+};
+
+}  // namespace ubpe
+
+#endif  // SERIALIZATION_HPP
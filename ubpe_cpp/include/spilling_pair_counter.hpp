@@ -0,0 +1,327 @@
+#ifndef SPILLING_PAIR_COUNTER_HPP
+#define SPILLING_PAIR_COUNTER_HPP
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "pair_counter.hpp"
+#include "utils.hpp"
+#include "word_table.hpp"
+
+namespace ubpe {
+
+/// @brief Counter of adjacent pairs that keeps counts within a memory budget
+/// by spilling them to files on disk.
+///
+/// Counts are accumulated in memory until they exceed the budget, and then
+/// appended to one of `N_PARTITIONS` files chosen by the hash of the pair, so
+/// all counts of a pair end up in the same file. Reading the files back one
+/// at a time gives exact counts while holding only a part of the pairs in
+/// memory. A file whose pairs do not fit the budget is split into
+/// `N_PARTITIONS` smaller files by another hash of the pairs, so the budget
+/// holds however many pairs were spilled.
+///
+/// Note: spilled counts are read back twice, first to find the most common
+/// pairs and then to collect the counts that candidate selection looks up.
+template <std::integral T>
+class SpillingPairCounter {
+   public:
+    /// Approximate memory taken by a pair counted in `PairCounter`, including
+    /// the overhead of the node-based hash map.
+    static constexpr std::size_t BYTES_PER_PAIR =
+        sizeof(std::pair<T, T>) + 2 * sizeof(std::size_t) + 2 * sizeof(void*);
+    /// Number of files spilled counts are partitioned into, and of files a
+    /// partition that does not fit the budget is split into.
+    static constexpr std::size_t N_PARTITIONS = 64;
+    /// Number of times a partition may be split; pairs with equal hashes can
+    /// not be separated, so partitions of the last level are read whole.
+    static constexpr std::size_t MAX_LEVEL = 8;
+
+   private:
+    /// Counts of a pair as written to disk.
+    struct Record {
+        T first;
+        T second;
+        std::size_t documents;
+        std::size_t occurrences;
+    };
+
+    /// File of spilled counts.
+    struct Partition {
+        /// Number of splits the partition is made by.
+        std::size_t level;
+        /// If the counts were moved to smaller partitions.
+        bool split;
+    };
+
+    std::size_t memory_budget;
+    std::filesystem::path parent_directory;
+    /// Directory with the spilled counts; created by the first spill.
+    std::filesystem::path directory{};
+    std::vector<Partition> partitions{};
+    /// Files of the first `N_PARTITIONS` partitions while counts are spilled.
+    std::vector<std::ofstream> writers{};
+    PairCounter<T> buffer{};
+
+    /// @brief Get the file of the `index`-th partition.
+    std::filesystem::path partition_path(std::size_t index) const {
+        return this->directory / (std::to_string(index) + ".bin");
+    }
+
+    /// @brief Get the index of the partition of `pair` among the partitions
+    /// of the `level`-th split.
+    static std::size_t partition_index(const std::pair<T, T>& pair,
+                                       std::size_t level) {
+        return splitmix64(PairHash<T>{}(pair) + level) % N_PARTITIONS;
+    }
+
+    /// @brief Open files of `N_PARTITIONS` new partitions of `level`.
+    std::vector<std::ofstream> add_partitions(std::size_t level) {
+        std::vector<std::ofstream> files;
+        for (std::size_t i = 0; i < N_PARTITIONS; i++) {
+            files.emplace_back(this->partition_path(this->partitions.size()),
+                               std::ios::binary);
+            this->partitions.push_back({level, false});
+        }
+        return files;
+    }
+
+    /// @brief Make a fresh directory for the spilled counts.
+    void make_directory() {
+        std::random_device device;
+        std::error_code error;
+        // retry on collisions with directories of other counters
+        while (true) {
+            auto path = this->parent_directory /
+                        ("ubpe-pairs-" + std::to_string(device()));
+            if (std::filesystem::create_directory(path, error)) {
+                this->directory = path;
+                return;
+            }
+            if (error)
+                throw std::runtime_error(
+                    "Can not create a directory for pair counts: " +
+                    error.message());
+        }
+    }
+
+    /// @brief Append counts in memory to the partitions and forget them.
+    void spill() {
+        if (this->partitions.empty()) {
+            this->make_directory();
+            this->writers = this->add_partitions(0);
+        }
+        for (auto it = this->buffer.cbegin(); it != this->buffer.cend();
+             it++) {
+            const auto& [pair, counts] = *it;
+            Record record{pair.first, pair.second, counts.first,
+                          counts.second};
+            this->writers[partition_index(pair, 0)].write(
+                reinterpret_cast<const char*>(&record), sizeof(Record));
+        }
+        for (auto& writer : this->writers) {
+            if (!writer)
+                throw std::runtime_error("Can not write pair counts to disk");
+        }
+        this->buffer.clear();
+    }
+
+    /// @brief Move counts of the `index`-th partition to `N_PARTITIONS` new
+    /// smaller partitions.
+    void split_partition(std::size_t index) {
+        auto level = this->partitions[index].level + 1;
+        auto files = this->add_partitions(level);
+        std::ifstream file(this->partition_path(index), std::ios::binary);
+        Record record;
+        while (file.read(reinterpret_cast<char*>(&record), sizeof(Record))) {
+            files[partition_index({record.first, record.second}, level)]
+                .write(reinterpret_cast<const char*>(&record), sizeof(Record));
+        }
+        for (auto& split_file : files) {
+            if (!split_file.flush())
+                throw std::runtime_error("Can not write pair counts to disk");
+        }
+        file.close();
+        this->partitions[index].split = true;
+        std::filesystem::remove(this->partition_path(index));
+    }
+
+    /// @brief Spill counts if they exceed the memory budget.
+    void check_budget() {
+        if (this->buffer.size() * BYTES_PER_PAIR > this->memory_budget)
+            this->spill();
+    }
+
+    /// @brief Read counts of the pairs of a partition for which `keep`
+    /// returns `true`.
+    /// @return Counts of the partition, or `std::nullopt` if they exceed the
+    /// memory budget and the partition can be split.
+    template <typename Predicate>
+    std::optional<PairCounter<T>> read_partition(std::size_t index,
+                                                 Predicate keep) const {
+        bool can_split = this->partitions[index].level < MAX_LEVEL;
+        PairCounter<T> counter;
+        std::ifstream file(this->partition_path(index), std::ios::binary);
+        Record record;
+        while (file.read(reinterpret_cast<char*>(&record), sizeof(Record))) {
+            std::pair<T, T> pair{record.first, record.second};
+            if (!keep(pair)) continue;
+            counter.add(pair, {record.documents, record.occurrences});
+            if (can_split &&
+                counter.size() * BYTES_PER_PAIR > this->memory_budget)
+                return std::nullopt;
+        }
+        return counter;
+    }
+
+    /// @brief Call `visit` with counts of the pairs of each partition for
+    /// which `keep` returns `true`, splitting partitions that do not fit the
+    /// memory budget.
+    template <typename Predicate, typename Visit>
+    void for_each_partition(Predicate keep, Visit visit) {
+        // partitions that are split off are appended and visited as well
+        for (std::size_t i = 0; i < this->partitions.size(); i++) {
+            if (this->partitions[i].split) continue;
+            auto counter = this->read_partition(i, keep);
+            if (counter.has_value())
+                visit(counter.value());
+            else
+                this->split_partition(i);
+        }
+    }
+
+   public:
+    /// @brief Constructor.
+    /// @param memory_budget Maximum memory in bytes taken by counts in memory.
+    /// @param parent_directory Directory to create files with spilled counts
+    /// in.
+    SpillingPairCounter(std::size_t memory_budget,
+                        std::filesystem::path parent_directory)
+        : memory_budget(memory_budget),
+          parent_directory(std::move(parent_directory)) {
+        if (memory_budget < BYTES_PER_PAIR)
+            throw std::invalid_argument(
+                "`memory_budget` is too small to count a single pair");
+    }
+
+    SpillingPairCounter(const SpillingPairCounter&) = delete;
+    SpillingPairCounter(SpillingPairCounter&&) = delete;
+    SpillingPairCounter& operator=(const SpillingPairCounter&) = delete;
+    SpillingPairCounter& operator=(SpillingPairCounter&&) = delete;
+    ~SpillingPairCounter() {
+        this->writers.clear();
+        if (!this->directory.empty()) {
+            std::error_code error;
+            std::filesystem::remove_all(this->directory, error);
+        }
+    }
+
+    /// @brief Check if any counts were spilled to disk.
+    bool spilled() const { return !this->partitions.empty(); }
+
+    /// @brief Update the counter with adjacent pairs in each document of
+    /// `corpus`.
+    /// @param corpus Documents split into words.
+    void update(const std::vector<std::vector<std::vector<T>>>& corpus) {
+        for (const auto& doc : corpus) {
+            this->buffer.update(doc);
+            this->check_budget();
+        }
+    }
+
+    /// @brief Update the counter with adjacent pairs in each document of
+    /// `corpus` weighted by the document's weight.
+    /// @param corpus Documents split into words with their weights.
+    void update(const WeightedCorpus<T>& corpus) {
+        for (std::size_t i = 0; i < corpus.documents.size(); i++) {
+            // pairs of dropped documents must not be candidates
+            if (corpus.weights[i] == 0) continue;
+            this->buffer.update(corpus.documents[i], corpus.weights[i]);
+            this->check_budget();
+        }
+    }
+
+    /// @brief Update the counter with adjacent pairs in each word of `table`
+    /// weighted by the word's counts.
+    /// @param table Table of unique words.
+    void update(const WordTable<T>& table) {
+        const auto& words = table.get_words();
+        const auto& counts = table.get_counts();
+        for (std::size_t i = 0; i < words.size(); i++) {
+            this->buffer.update_word(words[i], counts[i].second,
+                                     counts[i].first);
+            this->check_budget();
+        }
+    }
+
+    /// @brief Get exact counts needed to select candidates for new tokens.
+    /// @param n Number of most common pairs to select candidates from.
+    /// @param is_allowed Function of a pair of tokens that is `false` for
+    /// pairs that can not be candidates.
+    /// @return Counter with the `n` most common allowed pairs and all other
+    /// allowed pairs of their tokens, so that `most_common(n)` and lookups of
+    /// pairs of these tokens are the same as for a counter of all pairs.
+    ///
+    /// Note: counts are moved out of the counter, so this is called once.
+    template <typename Predicate>
+    PairCounter<T> candidates(std::size_t n, Predicate is_allowed) {
+        if (!this->spilled()) {
+            this->buffer.erase_if(
+                [&is_allowed](const auto& pair) { return !is_allowed(pair); });
+            return std::move(this->buffer);
+        }
+        this->spill();
+        this->writers.clear();
+
+        // partitions have distinct pairs, so the most common pairs of the
+        // corpus are among the most common pairs of the partitions
+        PairCounter<T> top;
+        this->for_each_partition(is_allowed, [&](const auto& counter) {
+            for (const auto& [pair, _] : counter.most_common(n)) {
+                top.add(pair, counter(pair));
+            }
+            // split partitions may be many, so only the most common pairs of
+            // those read so far are kept
+            if (top.size() >= 2 * n) {
+                PairCounter<T> kept;
+                for (const auto& [pair, _] : top.most_common(n)) {
+                    kept.add(pair, top(pair));
+                }
+                top = std::move(kept);
+            }
+        });
+        std::set<T> tokens;
+        for (const auto& [pair, _] : top.most_common(n)) {
+            tokens.insert({pair.first, pair.second});
+        }
+
+        // pairs of the tokens of candidates are looked up to check borders
+        PairCounter<T> result;
+        this->for_each_partition(
+            [&](const std::pair<T, T>& pair) {
+                return tokens.contains(pair.first) &&
+                       tokens.contains(pair.second) && is_allowed(pair);
+            },
+            [&](const auto& counter) {
+                for (auto it = counter.cbegin(); it != counter.cend(); it++) {
+                    result.add(it->first, it->second);
+                }
+            });
+        return result;
+    }
+};
+
+}  // namespace ubpe
+
+#endif  // SPILLING_PAIR_COUNTER_HPP
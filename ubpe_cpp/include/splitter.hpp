@@ -75,6 +75,16 @@ using OptionalPatternType = std::conditional_t<
     std::is_same_v<TokenType, char> || std::is_same_v<TokenType, wchar_t>,
     std::optional<std::basic_string<TokenType>>, std::monostate>;
 
+/// @brief Type of a function that splits a part of a document by a regex
+/// that is not available on the C++ side.
+///
+/// The function gets the part and the context pointer passed to
+/// `SplitPipeline::set_regex_callback`, and returns `[begin, end)` bounds of
+/// the matches in the part.
+template <DocumentT DocType>
+using RegexCallback = std::vector<std::pair<std::size_t, std::size_t>> (*)(
+    const DocType& part, void* context);
+
 /// @brief `SplitPipeline` configuration structure.
 ///
 /// Fields:
@@ -112,6 +122,27 @@ class SplitPipeline {
     [[no_unique_address]] OptionalRegexType<TokenType> regex{};
     std::optional<SSSTree<DocType, std::uint32_t>> kw_ssstree{};
 
+    RegexCallback<DocType> regex_callback = nullptr;
+    void* regex_context = nullptr;
+
+    UnknownPolicy unknown_policy = UnknownPolicy::RAISE;
+    /// Token that replaces unknown symbols for `UnknownPolicy::REPLACE`.
+    std::uint32_t unknown_replacement = 0;
+
+    /// @brief Convert a part of a document to tokens and append it to
+    /// `parts`, unless all its symbols are skipped as unknown.
+    void append_part(const DocType& part,
+                     std::vector<std::vector<std::uint32_t>>& parts) const {
+        std::vector<std::uint32_t> tokens;
+        tokens.reserve(part.size());
+        if (!map_symbols(part.cbegin(), part.cend(), this->alphabet,
+                         this->unknown_policy, this->unknown_replacement,
+                         tokens))
+            throw std::out_of_range("Unknown symbol");
+        if (!tokens.empty() || part.empty())
+            parts.emplace_back(std::move(tokens));
+    }
+
    public:
     /// @brief Constructor for the SplitPipeline class.
     /// @param alphabet A map representing the alphabet.
@@ -119,14 +150,21 @@ class SplitPipeline {
     SplitPipeline(const std::map<TokenType, std::uint32_t>& alphabet,
                   SplitPipelineConfig<DocType, TokenType> config = {})
         : alphabet(alphabet) {
-        // Check that the alphabet contains sequential tokens
-        std::uint32_t max_token = 0;
+        // Check that the alphabet contains sequential tokens; the order of
+        // tokens does not have to follow the order of letters
+        std::set<std::uint32_t> alphabet_tokens;
         for (const auto& [_, token_id] : this->alphabet) {
+            alphabet_tokens.insert(token_id);
+        }
+        std::uint32_t max_token = 0;
+        for (const auto& token_id : alphabet_tokens) {
             if (token_id != max_token)
                 throw std::runtime_error(
                     "alphabet contains non-sequential tokens");
             max_token++;
         }
+        if (alphabet_tokens.size() != this->alphabet.size())
+            throw std::runtime_error("alphabet contains non-unique tokens");
 
         std::unordered_set<TokenType> tokens;
         std::transform(this->alphabet.cbegin(), this->alphabet.cend(),
@@ -173,14 +211,23 @@ class SplitPipeline {
             this->known_words = std::nullopt;
 
         if (this->known_words.has_value()) {
-            // Check that known words are sequential right after alphabet tokens
+            // Check that known words are sequential right after alphabet
+            // tokens; the order of tokens does not have to follow the order of
+            // words
+            std::set<std::uint32_t> kw_tokens;
             for (const auto& [_, token_id] : this->known_words.value()) {
+                kw_tokens.insert(token_id);
+            }
+            for (const auto& token_id : kw_tokens) {
                 if (token_id != max_token)
                     throw std::logic_error(
                         "Tokens of `known_words` must be sequential right "
                         "after alphabet tokens.");
                 max_token++;
             }
+            if (kw_tokens.size() != this->known_words->size())
+                throw std::logic_error(
+                    "Tokens of `known_words` must be unique.");
 
             this->kw_ssstree.emplace();
             for (const auto& word : this->known_words.value()) {
@@ -284,6 +331,29 @@ class SplitPipeline {
         if (this->stop_tokens.has_value() && this->stop_tokens->empty())
             this->stop_tokens = std::nullopt;
     }
+    /// @brief Constructor for the SplitPipeline class.
+    /// @param alphabet A map representing the alphabet.
+    /// @param known_words Known words with their tokens.
+    /// @param break_tokens Break tokens.
+    /// @param stop_tokens Stop tokens.
+    ///
+    /// Note: useful for integration with Cython, which can not build the
+    /// variants of `SplitPipelineConfig`.
+    SplitPipeline(
+        const std::map<TokenType, std::uint32_t>& alphabet,
+        const std::optional<std::map<DocType, std::uint32_t>>& known_words,
+        const std::optional<std::set<TokenType>>& break_tokens,
+        const std::optional<std::set<TokenType>>& stop_tokens)
+        : SplitPipeline(alphabet, [&]() {
+              SplitPipelineConfig<DocType, TokenType> config{};
+              if (known_words.has_value())
+                  config.known_words = known_words.value();
+              if (break_tokens.has_value())
+                  config.break_tokens = break_tokens.value();
+              if (stop_tokens.has_value())
+                  config.stop_tokens = stop_tokens.value();
+              return config;
+          }()) {}
     SplitPipeline() = default;
     SplitPipeline(const SplitPipeline&) = default;
     SplitPipeline(SplitPipeline&&) = default;
@@ -322,14 +392,7 @@ class SplitPipeline {
                     auto split = DocType(part_begin, doc.cbegin() + si);
                     for (const DocType& part :
                          this->split_part(split, mode, leave_separators)) {
-                        std::vector<std::uint32_t> _part{};
-                        _part.reserve(part.size());
-                        std::transform(part.cbegin(), part.cend(),
-                                       std::back_inserter(_part),
-                                       [this](const TokenType& token) {
-                                           return this->alphabet.at(token);
-                                       });
-                        parts.emplace_back(_part);
+                        this->append_part(part, parts);
                     }
                 }
 
@@ -337,7 +400,8 @@ class SplitPipeline {
                     parts.push_back({kw_candidates.back().second});
                 }
                 part_begin = doc.cbegin() + si + kw_candidates.back().first;
-                si += kw_candidates.back().first;
+                // the loop increment moves `si` right after the known word
+                si += kw_candidates.back().first - 1;
             }
 
             // add the remaining part if it exists
@@ -345,14 +409,7 @@ class SplitPipeline {
                 auto split = DocType(part_begin, doc.cend());
                 for (const DocType& part :
                      this->split_part(split, mode, leave_separators)) {
-                    std::vector<std::uint32_t> _part{};
-                    _part.reserve(part.size());
-                    std::transform(part.cbegin(), part.cend(),
-                                   std::back_inserter(_part),
-                                   [this](const TokenType& token) {
-                                       return this->alphabet.at(token);
-                                   });
-                    parts.emplace_back(_part);
+                    this->append_part(part, parts);
                 }
             }
 
@@ -364,14 +421,7 @@ class SplitPipeline {
         std::vector<std::vector<std::uint32_t>> parts{};
         for (const DocType& part :
              this->split_part(doc, mode, leave_separators)) {
-            std::vector<std::uint32_t> _part{};
-            _part.reserve(part.size());
-            std::transform(part.cbegin(), part.cend(),
-                           std::back_inserter(_part),
-                           [this](const TokenType& token) {
-                               return this->alphabet.at(token);
-                           });
-            parts.emplace_back(_part);
+            this->append_part(part, parts);
         }
         return parts;
     }
@@ -404,6 +454,39 @@ class SplitPipeline {
     /// @brief Get the regex.
     OptionalRegexType<TokenType> get_regex() const { return regex; }
 
+    /// @brief Set handling of symbols that are not in the alphabet.
+    /// @param policy The policy.
+    /// @param replacement Symbol of the alphabet that replaces unknown ones,
+    /// required for `UnknownPolicy::REPLACE`.
+    void set_unknown_policy(
+        UnknownPolicy policy,
+        std::optional<TokenType> replacement = std::nullopt) {
+        if (policy == UnknownPolicy::REPLACE) {
+            if (!replacement.has_value() ||
+                !this->alphabet.contains(replacement.value()))
+                throw std::invalid_argument(
+                    "`replacement` must be a symbol of the alphabet");
+            this->unknown_replacement = this->alphabet.at(replacement.value());
+        }
+        this->unknown_policy = policy;
+    }
+
+    /// @brief Get handling of symbols that are not in the alphabet.
+    UnknownPolicy get_unknown_policy() const { return this->unknown_policy; }
+
+    /// @brief Set an external function to split parts of documents by regex.
+    /// @param callback The function, or `nullptr` to remove it.
+    /// @param context Pointer passed to each call of `callback`.
+    ///
+    /// Note: the callback is used only if the pipeline has no regex of its
+    /// own, e.g. when `TokenType` is a code point and the regex lives in
+    /// Python.
+    void set_regex_callback(RegexCallback<DocType> callback,
+                            void* context = nullptr) {
+        this->regex_callback = callback;
+        this->regex_context = context;
+    }
+
    private:
     /// @brief Split a part of a document by tokens.
     static std::vector<DocType> split_part_by_tokens(
@@ -455,6 +538,17 @@ class SplitPipeline {
                 return matches;
             }
         }
+        if (this->regex_callback != nullptr) {
+            std::vector<DocType> matches;
+            for (const auto& [begin, end] :
+                 this->regex_callback(part, this->regex_context)) {
+                if (begin > end || end > part.size())
+                    throw std::out_of_range("Regex match is out of range");
+                matches.emplace_back(part.cbegin() + begin,
+                                     part.cbegin() + end);
+            }
+            return matches;
+        }
         return {part};
     }
 
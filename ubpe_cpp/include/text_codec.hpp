@@ -0,0 +1,335 @@
+#ifndef TEXT_CODEC_HPP
+#define TEXT_CODEC_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace ubpe {
+
+/// @brief Dense mappings between Unicode code points and alphabet tokens.
+///
+/// Used by the character-level tokenizers to turn UTF-8 text into token
+/// sequences and back on the C++ side, so no Python strings are built per
+/// character.
+class TextCodec {
+   private:
+    /// Token for each code point, or `-1` if the code point is not in the
+    /// alphabet; the table is as long as the largest code point + 1.
+    std::vector<std::int64_t> forward;
+    /// UTF-8 representation of each token, including known words; empty for
+    /// unknown tokens.
+    std::vector<std::string> backward;
+
+    UnknownPolicy unknown_policy = UnknownPolicy::RAISE;
+    /// Token that replaces unknown letters and tokens for
+    /// `UnknownPolicy::REPLACE`.
+    std::int64_t unknown_replacement = -1;
+
+    /// @brief Get UTF-8 representation of `token`, or `nullptr` if the token
+    /// is not in the codec.
+    const std::string* find_backward(std::int64_t token) const {
+        if (token < 0 ||
+            static_cast<std::size_t>(token) >= this->backward.size() ||
+            this->backward[token].empty())
+            return nullptr;
+        return &this->backward[token];
+    }
+
+    /// @brief Append UTF-8 representation of a code point to `text`.
+    ///
+    /// Note: surrogates are encoded as any other code point, so they can be
+    /// restored with the `surrogatepass` error handler of Python.
+    static void append_utf8(std::string& text, std::uint32_t code_point) {
+        if (code_point < 0x80) {
+            text.push_back(static_cast<char>(code_point));
+        } else if (code_point < 0x800) {
+            text.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+            text.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        } else if (code_point < 0x10000) {
+            text.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+            text.push_back(
+                static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            text.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        } else {
+            text.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+            text.push_back(
+                static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+            text.push_back(
+                static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            text.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        }
+    }
+
+    /// @brief Replace `\r\n` and `\r` in `text` by `\n`.
+    static void normalize_newlines(std::string& text) {
+        std::size_t left = 0;
+        for (std::size_t right = 0; right < text.size(); right++) {
+            if (text[right] != '\r') {
+                text[left++] = text[right];
+                continue;
+            }
+            text[left++] = '\n';
+            if (right + 1 < text.size() && text[right + 1] == '\n') right++;
+        }
+        text.resize(left);
+    }
+
+    /// @brief Store `text` as the representation of `token`.
+    void set_backward(std::int64_t token, std::string text) {
+        if (token < 0) throw std::invalid_argument("Token must be positive");
+        if (static_cast<std::size_t>(token) >= this->backward.size())
+            this->backward.resize(token + 1);
+        this->backward[token] = std::move(text);
+    }
+
+   public:
+    TextCodec() = default;
+
+    /// @brief Construct the codec from a code point to token mapping.
+    /// @param alphabet Mapping from code points to alphabet tokens.
+    /// @param known_words Mapping from tokens of known words to their UTF-8
+    /// representations.
+    TextCodec(const std::map<std::uint32_t, std::int64_t>& alphabet,
+              const std::map<std::int64_t, std::string>& known_words = {}) {
+        if (!alphabet.empty()) {
+            if (alphabet.crbegin()->first > 0x10FFFF)
+                throw std::invalid_argument(
+                    "Code point is out of Unicode range");
+
+            this->forward.assign(alphabet.crbegin()->first + 1, -1);
+            for (const auto& [code_point, token] : alphabet) {
+                this->forward[code_point] = token;
+
+                std::string text;
+                append_utf8(text, code_point);
+                this->set_backward(token, std::move(text));
+            }
+        }
+        for (const auto& [token, word] : known_words) {
+            this->set_backward(token, word);
+        }
+    }
+
+    TextCodec(const TextCodec&) = default;
+    TextCodec(TextCodec&&) = default;
+    TextCodec& operator=(const TextCodec&) = default;
+    TextCodec& operator=(TextCodec&&) = default;
+    ~TextCodec() = default;
+
+    /// @brief Convert UTF-8 text to a sequence of alphabet tokens.
+    /// @param text UTF-8 encoded text.
+    /// @param size Length of `text` in bytes.
+    /// @param doc Vector the tokens are appended to.
+    /// @param surrogates If surrogates are accepted, as written by the
+    /// `surrogatepass` error handler of Python; otherwise they are malformed.
+    ///
+    /// Note: malformed UTF-8 sequences, including overlong ones, and code
+    /// points that are not in the alphabet are handled according to the
+    /// unknown policy; a malformed sequence is skipped or replaced byte by
+    /// byte. With `UnknownPolicy::RAISE` throws `std::invalid_argument`.
+    void encode(const char* text, std::size_t size,
+                std::vector<std::int64_t>& doc, bool surrogates = true) const {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(text);
+        std::size_t i = 0;
+        while (i < size) {
+            std::uint32_t code_point = 0;
+            std::size_t length = 1;
+            // description of a malformed sequence
+            const char* error = nullptr;
+            if (bytes[i] < 0x80) {
+                code_point = bytes[i];
+            } else if ((bytes[i] & 0xE0) == 0xC0) {
+                code_point = bytes[i] & 0x1F;
+                length = 2;
+            } else if ((bytes[i] & 0xF0) == 0xE0) {
+                code_point = bytes[i] & 0x0F;
+                length = 3;
+            } else if ((bytes[i] & 0xF8) == 0xF0) {
+                code_point = bytes[i] & 0x07;
+                length = 4;
+            } else {
+                error = "Invalid UTF-8 sequence";
+            }
+            if (error == nullptr && i + length > size)
+                error = "Truncated UTF-8 sequence";
+            for (std::size_t j = 1; error == nullptr && j < length; j++) {
+                if ((bytes[i + j] & 0xC0) != 0x80)
+                    error = "Invalid UTF-8 sequence";
+                code_point = (code_point << 6) | (bytes[i + j] & 0x3F);
+            }
+            // only the shortest forms of code points of Unicode are valid
+            if (error == nullptr &&
+                ((length == 2 && code_point < 0x80) ||
+                 (length == 3 && code_point < 0x800) ||
+                 (length == 4 && code_point < 0x10000) ||
+                 code_point > 0x10FFFF ||
+                 (!surrogates && code_point >= 0xD800 && code_point < 0xE000)))
+                error = "Invalid UTF-8 sequence";
+
+            if (error == nullptr && code_point < this->forward.size() &&
+                this->forward[code_point] >= 0) {
+                doc.emplace_back(this->forward[code_point]);
+                i += length;
+                continue;
+            }
+            if (this->unknown_policy == UnknownPolicy::RAISE) {
+                throw std::invalid_argument(
+                    error != nullptr ? error : "Unknown letter");
+            }
+            if (this->unknown_policy == UnknownPolicy::REPLACE)
+                doc.emplace_back(this->unknown_replacement);
+            // a malformed sequence is handled byte by byte
+            i += error != nullptr ? 1 : length;
+        }
+    }
+
+    /// @brief Convert UTF-8 text to a sequence of alphabet tokens.
+    /// @param text UTF-8 encoded text.
+    /// @return Sequence of alphabet tokens.
+    std::vector<std::int64_t> encode(const std::string& text) const {
+        std::vector<std::int64_t> doc;
+        doc.reserve(text.size());
+        this->encode(text.data(), text.size(), doc);
+        return doc;
+    }
+
+    /// @brief Convert a sequence of alphabet and known words tokens to UTF-8
+    /// text.
+    /// @param tokens Sequence of tokens.
+    /// @return UTF-8 encoded text.
+    ///
+    /// Note: tokens that are not in the codec are handled according to the
+    /// unknown policy; with `UnknownPolicy::RAISE` throws
+    /// `std::invalid_argument`.
+    std::string decode(const std::vector<std::int64_t>& tokens) const {
+        const auto* replacement =
+            this->unknown_policy == UnknownPolicy::REPLACE
+                ? this->find_backward(this->unknown_replacement)
+                : nullptr;
+
+        std::size_t size = 0;
+        for (const auto& token : tokens) {
+            const auto* text = this->find_backward(token);
+            if (text == nullptr) {
+                if (this->unknown_policy == UnknownPolicy::RAISE)
+                    throw std::invalid_argument("Unknown token");
+                text = replacement;
+            }
+            if (text != nullptr) size += text->size();
+        }
+
+        std::string text;
+        text.reserve(size);
+        for (const auto& token : tokens) {
+            const auto* token_text = this->find_backward(token);
+            if (token_text == nullptr) token_text = replacement;
+            if (token_text != nullptr) text.append(*token_text);
+        }
+        return text;
+    }
+
+    /// @brief Set handling of letters that are not in the alphabet, of
+    /// malformed UTF-8 and of tokens that are not in the codec.
+    /// @param policy The policy.
+    /// @param replacement Token of the alphabet that replaces unknown letters
+    /// and tokens, required for `UnknownPolicy::REPLACE`.
+    void set_unknown_policy(UnknownPolicy policy,
+                            std::optional<std::int64_t> replacement) {
+        if (policy == UnknownPolicy::REPLACE) {
+            if (!replacement.has_value() ||
+                this->find_backward(replacement.value()) == nullptr)
+                throw std::invalid_argument(
+                    "`replacement` must be a token of the alphabet");
+            this->unknown_replacement = replacement.value();
+        }
+        this->unknown_policy = policy;
+    }
+
+    /// @brief Read UTF-8 text files document by document.
+    /// @param paths Paths to the files.
+    /// @param by_lines If each non-empty line is a separate document;
+    /// otherwise each file is a single document.
+    /// @param consume Function called with each document as a sequence of
+    /// alphabet tokens as soon as it is read.
+    ///
+    /// Note: files are read as Python reads text files, i.e. `\r\n` and `\r`
+    /// end lines as `\n` does and are read as `\n`, and surrogates are
+    /// malformed. With `by_lines` only a line is kept in memory at a time.
+    template <typename Consume>
+    void read_files(const std::vector<std::string>& paths, bool by_lines,
+                    Consume&& consume) const {
+        for (const auto& path : paths) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file.is_open())
+                throw std::runtime_error("Can not open file: " + path);
+
+            std::string text;
+            if (by_lines) {
+                bool first_line = true;
+                while (std::getline(file, text)) {
+                    // skip byte order mark
+                    std::size_t offset =
+                        first_line && text.starts_with("\xEF\xBB\xBF") ? 3 : 0;
+                    first_line = false;
+                    // lines are read in binary mode, so `\r` also ends lines,
+                    // and `\r` of `\r\n` ends an empty line, which is skipped
+                    while (offset < text.size()) {
+                        auto end =
+                            std::min(text.find('\r', offset), text.size());
+                        if (end > offset) {
+                            std::vector<std::int64_t> doc;
+                            doc.reserve(end - offset);
+                            this->encode(text.data() + offset, end - offset,
+                                         doc, false);
+                            consume(std::move(doc));
+                        }
+                        offset = end + 1;
+                    }
+                }
+            } else {
+                text.assign(std::istreambuf_iterator<char>(file),
+                            std::istreambuf_iterator<char>());
+                normalize_newlines(text);
+                std::size_t offset = text.starts_with("\xEF\xBB\xBF") ? 3 : 0;
+                if (text.size() > offset) {
+                    std::vector<std::int64_t> doc;
+                    doc.reserve(text.size() - offset);
+                    this->encode(text.data() + offset, text.size() - offset,
+                                 doc, false);
+                    consume(std::move(doc));
+                }
+            }
+            if (file.bad())
+                throw std::runtime_error("Can not read file: " + path);
+        }
+    }
+
+    /// @brief Read UTF-8 text files as a corpus of token sequences.
+    /// @param paths Paths to the files.
+    /// @param by_lines If each non-empty line is a separate document;
+    /// otherwise each file is a single document.
+    /// @return Corpus of token sequences.
+    std::vector<std::vector<std::int64_t>> read_files(
+        const std::vector<std::string>& paths, bool by_lines = true) const {
+        std::vector<std::vector<std::int64_t>> corpus;
+        this->read_files(paths, by_lines,
+                         [&corpus](std::vector<std::int64_t>&& doc) {
+                             corpus.emplace_back(std::move(doc));
+                         });
+        return corpus;
+    }
+};
+
+}  // namespace ubpe
+
+#endif  // TEXT_CODEC_HPP
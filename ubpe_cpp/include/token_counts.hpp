@@ -0,0 +1,102 @@
+#ifndef TOKEN_COUNTS_HPP
+#define TOKEN_COUNTS_HPP
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace ubpe {
+
+/// @brief Counts of tokens in a short sequence.
+///
+/// Counts are kept sorted by tokens; up to `N` distinct tokens are stored
+/// inline, so copying and updating counts of short sequences do not allocate
+/// memory. Longer sequences spill over to a vector.
+template <std::integral T, std::size_t N = 8>
+class TokenCounts {
+   public:
+    using value_type = std::pair<T, std::uint32_t>;
+    using const_iterator = const value_type*;
+
+   private:
+    std::array<value_type, N> small{};
+    std::vector<value_type> large;
+    /// Number of distinct tokens.
+    std::size_t n = 0;
+
+    value_type* data() {
+        return this->n > N ? this->large.data() : this->small.data();
+    }
+    const value_type* data() const {
+        return this->n > N ? this->large.data() : this->small.data();
+    }
+
+    /// @brief Find the first count whose token is not less than `token`.
+    const value_type* find(T token) const {
+        return std::lower_bound(
+            this->data(), this->data() + this->n, token,
+            [](const value_type& element, T token) {
+                return element.first < token;
+            });
+    }
+
+   public:
+    TokenCounts() = default;
+    TokenCounts(const TokenCounts&) = default;
+    TokenCounts(TokenCounts&&) = default;
+    TokenCounts& operator=(const TokenCounts&) = default;
+    TokenCounts& operator=(TokenCounts&&) = default;
+    ~TokenCounts() = default;
+
+    /// @brief Number of distinct tokens.
+    std::size_t size() const { return this->n; }
+
+    /// @brief Check if there are no tokens.
+    bool empty() const { return this->n == 0; }
+
+    const_iterator begin() const { return this->data(); }
+    const_iterator end() const { return this->data() + this->n; }
+    const_iterator cbegin() const { return this->begin(); }
+    const_iterator cend() const { return this->end(); }
+
+    /// @brief Get count of `token`, 0 if it is not present.
+    std::uint32_t at(T token) const {
+        auto it = this->find(token);
+        return it != this->end() && it->first == token ? it->second : 0;
+    }
+
+    /// @brief Add one occurrence of `token`.
+    /// @return New count of `token`.
+    std::uint32_t increment(T token) {
+        auto position = static_cast<std::size_t>(this->find(token) -
+                                                 this->cbegin());
+        auto* first = this->data();
+        if (position < this->n && first[position].first == token)
+            return ++first[position].second;
+
+        if (this->n < N) {
+            std::move_backward(first + position, first + this->n,
+                               first + this->n + 1);
+            first[position] = {token, 1};
+        } else if (this->n == N) {
+            // spill over
+            this->large.reserve(2 * N);
+            this->large.assign(first, first + position);
+            this->large.emplace_back(token, 1);
+            this->large.insert(this->large.end(), first + position,
+                               first + this->n);
+        } else {
+            this->large.insert(this->large.begin() + position, {token, 1});
+        }
+        this->n++;
+        return 1;
+    }
+};
+
+}  // namespace ubpe
+
+#endif  // TOKEN_COUNTS_HPP
@@ -2,28 +2,96 @@
 #define TOP_ELEMENTS
 
 #include <algorithm>
+#include <cstddef>
 #include <functional>
+#include <utility>
 #include <vector>
 
-#include "heapq.hpp"
-
 namespace ubpe {
 
-/// @brief `ubpe::heapq` wrapper for more efficient finding of top n elements in
-/// a stream.
+/// @brief Container for efficient finding of top n elements in a stream.
 ///
-/// Note: it has a min-heap under the hood.
+/// `comp(a, b)` means that `a` is worse than `b`; among equal elements the
+/// ones pushed earlier are kept. For `n <= SMALL_N` elements are kept in an
+/// array sorted from the best to the worst, otherwise in a heap with the
+/// worst element on top.
 template <typename T, typename Compare = std::less<T>>
 class TopElements {
+   public:
+    /// Maximum `n` for which elements are kept in a sorted array.
+    static constexpr std::size_t SMALL_N = 16;
+
    private:
+    struct Entry {
+        T value;
+        /// Position of the element in the stream.
+        std::size_t order;
+    };
+
     std::size_t n;
-    heapq<T> heap;
+    Compare comp;
+    std::vector<Entry> entries;
+    std::size_t n_pushed = 0;
+
+    /// @brief Check if `lhs` is better than `rhs`.
+    bool better(const Entry& lhs, const Entry& rhs) const {
+        if (this->comp(rhs.value, lhs.value)) return true;
+        if (this->comp(lhs.value, rhs.value)) return false;
+        return lhs.order < rhs.order;
+    }
+
+    /// @brief Check if elements are kept in a sorted array.
+    bool is_small() const { return this->n <= SMALL_N; }
+
+    /// @brief Comparator of the heap, so the worst element is on top.
+    auto heap_compare() const {
+        return [this](const Entry& lhs, const Entry& rhs) {
+            return this->better(lhs, rhs);
+        };
+    }
+
+    /// @brief Add an entry if it is among the top n ones.
+    void insert(Entry&& entry) {
+        if (this->is_small()) {
+            if (this->entries.size() == this->n) {
+                if (!this->better(entry, this->entries.back())) return;
+                this->entries.pop_back();
+            }
+            // `entry` is the newest one, so it is placed after equal ones
+            auto position = std::upper_bound(
+                this->entries.begin(), this->entries.end(), entry,
+                [this](const Entry& lhs, const Entry& rhs) {
+                    return this->better(lhs, rhs);
+                });
+            this->entries.insert(position, std::move(entry));
+        } else if (this->entries.size() < this->n) {
+            this->entries.emplace_back(std::move(entry));
+            std::push_heap(this->entries.begin(), this->entries.end(),
+                           this->heap_compare());
+        } else if (this->better(entry, this->entries.front())) {
+            std::pop_heap(this->entries.begin(), this->entries.end(),
+                          this->heap_compare());
+            this->entries.back() = std::move(entry);
+            std::push_heap(this->entries.begin(), this->entries.end(),
+                           this->heap_compare());
+        }
+    }
+
+    /// @brief Sort entries from the best to the worst.
+    void sort() {
+        if (!this->is_small()) {
+            std::sort_heap(this->entries.begin(), this->entries.end(),
+                           this->heap_compare());
+        }
+    }
 
    public:
     /// @brief Initialize a TopElements object with a maximum size and a
     /// comparison function.
     TopElements(std::size_t n, Compare comp = Compare())
-        : n(n), heap({.compare = comp}) {}
+        : n(n), comp(comp) {
+        if (this->is_small()) this->entries.reserve(n);
+    }
 
     TopElements(const TopElements&) = default;
     TopElements(TopElements&&) = default;
@@ -31,48 +99,75 @@ class TopElements {
     TopElements& operator=(TopElements&&) = default;
     ~TopElements() = default;
 
-    /// @brief Push an element into the heap.
-    /// @param element An element to add.
-    void push(const T& element) {
-        if (this->heap.size() < n) {
-            this->heap.push(element);
-        } else if (element > this->heap.top()) {
-            this->heap.replace(element);
-        }
+    /// @brief Construct an element in place and add it if it is among the top
+    /// n ones.
+    /// @param args Arguments of the constructor of `T`.
+    template <typename... Args>
+    void emplace(Args&&... args) {
+        if (this->n == 0) return;
+        this->insert(Entry{T(std::forward<Args>(args)...), this->n_pushed++});
     }
 
-    /// @brief Push an element into the heap.
+    /// @brief Push an element into the container.
+    /// @param element An element to add.
+    void push(const T& element) { this->emplace(element); }
+
+    /// @brief Push an element into the container.
     /// @param element An element to add.
-    void push(T&& element) {
-        auto _element = std::move(element);
-        if (this->heap.size() < n) {
-            this->heap.push(_element);
-        } else if (element > this->heap.top()) {
-            this->heap.replace(_element);
+    void push(T&& element) { this->emplace(std::move(element)); }
+
+    /// @brief Remove the worst element.
+    void pop() {
+        if (this->is_small()) {
+            this->entries.pop_back();
+        } else {
+            std::pop_heap(this->entries.begin(), this->entries.end(),
+                          this->heap_compare());
+            this->entries.pop_back();
         }
     }
 
-    /// @brief Pop the top element from the heap.
-    void pop() { auto _ = this->heap.pop(); }
+    /// @brief Check if the container is empty.
+    bool empty() const { return this->entries.empty(); }
 
-    /// @brief Check if the heap is empty.
-    bool empty() const { return this->heap.empty(); }
+    /// @brief Get the number of kept elements.
+    std::size_t size() const { return this->entries.size(); }
 
-    /// @brief Get the size of the heap.
-    std::size_t size() const { return this->heap.size(); }
+    /// @brief Get the number of elements pushed into the container.
+    std::size_t pushed() const { return this->n_pushed; }
 
-    /// @brief Get the top element from the heap.
-    const T& top() const { return this->heap.top(); }
+    /// @brief Get the worst of the kept elements.
+    const T& top() const {
+        return this->is_small() ? this->entries.back().value
+                                : this->entries.front().value;
+    }
 
-    /// @brief Get sorted top n elements.
+    /// @brief Get kept elements sorted from the best to the worst.
     std::vector<T> sorted() const {
-        std::vector<T> data = this->heap.container();
-        std::stable_sort(data.begin(), data.end(), std::greater<T>());
+        auto copy = *this;
+        return copy.extract();
+    }
+
+    /// @brief Get kept elements in the inner order.
+    std::vector<T> data() const {
+        std::vector<T> data;
+        data.reserve(this->entries.size());
+        for (const auto& entry : this->entries) data.emplace_back(entry.value);
         return data;
     }
 
-    /// @brief Get raw heap elements.
-    std::vector<T> data() const { return this->heap.container(); }
+    /// @brief Move kept elements out sorted from the best to the worst; the
+    /// container is empty after that.
+    std::vector<T> extract() {
+        this->sort();
+        std::vector<T> data;
+        data.reserve(this->entries.size());
+        for (auto& entry : this->entries) {
+            data.emplace_back(std::move(entry.value));
+        }
+        this->entries.clear();
+        return data;
+    }
 };
 
 }  // namespace ubpe
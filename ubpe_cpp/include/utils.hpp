@@ -4,9 +4,11 @@
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
+#include <new>
 #include <string>
 #include <utility>
 #include <variant>
+#include <vector>
 
 namespace ubpe {
 
@@ -54,6 +56,53 @@ struct PairHash {
     }
 };
 
+/// @brief Hash function for `std::vector<T>` that folds elements with the same
+/// SplitMix64 pre-mixing and Boost-style combination as `PairHash`.
+///
+/// @tparam T Integral type (constrained by std::integral)
+template <std::integral T>
+struct VectorHash {
+    [[nodiscard]] std::size_t operator()(const std::vector<T>& v) const {
+        std::uint64_t h = splitmix64(v.size());
+        for (const auto& element : v) {
+            auto he = splitmix64(static_cast<std::uint64_t>(element));
+            h ^= he + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        }
+        return h;
+    }
+};
+
+/// @brief Allocator of memory aligned to `Alignment` bytes, e.g. for buffers
+/// that are processed with SIMD instructions.
+///
+/// @tparam T Type of elements.
+/// @tparam Alignment Alignment in bytes, a power of two.
+template <typename T, std::size_t Alignment>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    [[nodiscard]] T* allocate(std::size_t n) {
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+    }
+    void deallocate(T* p, std::size_t n) noexcept {
+        ::operator delete(p, n * sizeof(T), std::align_val_t{Alignment});
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept {
+        return true;
+    }
+};
+
 /// `std::variant` wrapper without the need for using `std::get` to access
 /// contained data.
 ///
@@ -213,6 +262,58 @@ class Flags : public EnumWrapper<E> {
     }
 };
 
+/// @brief Handling of symbols that are not in the alphabet and of tokens that
+/// are not in the vocabulary.
+enum class UnknownPolicy : std::uint8_t {
+    /// Throw an exception.
+    RAISE = 0,
+    /// Drop unknown symbols and tokens.
+    SKIP = 1,
+    /// Replace unknown symbols and tokens with a symbol of the alphabet.
+    REPLACE = 2
+};
+
+/// @brief Search used to encode words.
+enum class EncodeMode : std::uint8_t {
+    /// Weighted search over all segmentations of a word.
+    LATTICE = 0,
+    /// Forward maximum match: the longest token at each position.
+    GREEDY = 1,
+    /// `LATTICE` for a single encoding with weights of tails compared in
+    /// single precision; weights within a relative difference of 1e-6 of the
+    /// best one are compared again in double precision, so the result may
+    /// differ from `LATTICE` only where weights are equal up to rounding in
+    /// double precision.
+    LATTICE_F32 = 2
+};
+
+/// @brief Convert symbols to tokens of the alphabet, handling unknown symbols
+/// according to `policy`.
+/// @param first Iterator to the first symbol.
+/// @param last Iterator past the last symbol.
+/// @param alphabet Mapping from symbols to tokens.
+/// @param policy Handling of unknown symbols.
+/// @param replacement Token for unknown symbols if `policy` is `REPLACE`.
+/// @param tokens Vector the tokens are appended to.
+/// @return `false` if an unknown symbol is met and `policy` is `RAISE`; the
+/// symbols after it are not converted then.
+template <typename It, typename Map>
+bool map_symbols(It first, It last, const Map& alphabet, UnknownPolicy policy,
+                 std::uint32_t replacement,
+                 std::vector<std::uint32_t>& tokens) {
+    for (; first != last; first++) {
+        auto it = alphabet.find(*first);
+        if (it != alphabet.end()) {
+            tokens.emplace_back(it->second);
+        } else if (policy == UnknownPolicy::REPLACE) {
+            tokens.emplace_back(replacement);
+        } else if (policy == UnknownPolicy::RAISE) {
+            return false;
+        }
+    }
+    return true;
+}
+
 }  // namespace ubpe
 
 #endif  // UBPE_UTILS
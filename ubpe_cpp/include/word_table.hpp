@@ -0,0 +1,133 @@
+#ifndef WORD_TABLE_HPP
+#define WORD_TABLE_HPP
+
+#include <concepts>
+#include <cstddef>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace ubpe {
+
+/// @brief Table of unique words of a corpus with their occurrence statistics.
+///
+/// Documents are added chunk by chunk and each of them is immediately reduced
+/// to its unique words, so the memory needed for training depends on the
+/// number of unique words rather than on the size of the corpus. Words with
+/// counts computed elsewhere may be added directly.
+///
+/// Note: words shorter than two tokens are not stored, as they contain no
+/// pairs to merge, but their documents are still counted. Documents are not
+/// kept, so the number of documents a pair occurs in is summed over the
+/// words it occurs in, and it is capped by the number of documents when
+/// weights of tokens are computed.
+template <std::integral T>
+class WordTable {
+   private:
+    std::unordered_map<std::vector<T>, std::size_t, VectorHash<T>> index;
+    std::vector<std::vector<T>> words;
+    // `.first` --- count of documents
+    // `.second` --- count of occurrences
+    std::vector<std::pair<std::size_t, std::size_t>> counts;
+    std::size_t n_documents = 0;
+    bool frozen = false;
+
+    /// @brief Get the position of `word`, adding it if it is new.
+    std::size_t find_or_add(const std::vector<T>& word) {
+        auto [it, is_new] = this->index.try_emplace(word, this->words.size());
+        if (is_new) {
+            this->words.emplace_back(word);
+            this->counts.emplace_back(0, 0);
+        }
+        return it->second;
+    }
+
+   public:
+    WordTable() = default;
+    WordTable(const WordTable&) = default;
+    WordTable(WordTable&&) = default;
+    WordTable& operator=(const WordTable&) = default;
+    WordTable& operator=(WordTable&&) = default;
+    ~WordTable() = default;
+
+    /// @brief Add a document split into words to the table.
+    /// @param doc Vector of words.
+    void add_document(const std::vector<std::vector<T>>& doc) {
+        this->add_word(doc, 1, 1);
+        this->n_documents++;
+    }
+
+    /// @brief Add a word with precomputed counts to the table.
+    /// @param parts The word split into parts, e.g. by break tokens.
+    /// @param occurrences Number of occurrences of the word in the corpus.
+    /// @param documents Number of documents the word occurs in.
+    ///
+    /// Note: documents of the corpus are counted by `add_documents` only.
+    void add_word(const std::vector<std::vector<T>>& parts,
+                  std::size_t occurrences, std::size_t documents) {
+        if (this->frozen)
+            throw std::logic_error("Can not add words to a frozen table");
+
+        std::unordered_set<std::size_t> unique_parts;
+        for (const auto& part : parts) {
+            if (part.size() < 2) continue;
+
+            auto i = this->find_or_add(part);
+            this->counts[i].second += occurrences;
+            unique_parts.insert(i);
+        }
+        for (const auto& i : unique_parts) {
+            this->counts[i].first += documents;
+        }
+    }
+
+    /// @brief Count documents whose words are added with `add_word`.
+    /// @param count Number of documents.
+    void add_documents(std::size_t count) {
+        if (this->frozen)
+            throw std::logic_error("Can not add documents to a frozen table");
+        this->n_documents += count;
+    }
+
+    /// @brief Stop accepting new documents and drop the lookup index.
+    ///
+    /// Note: words may be modified in place only after the table is frozen,
+    /// as modifications invalidate the index.
+    void freeze() {
+        this->frozen = true;
+        this->index = {};
+    }
+
+    /// @brief Check if the table is frozen.
+    bool is_frozen() const { return this->frozen; }
+
+    /// @brief Number of unique words in the table.
+    std::size_t size() const { return this->words.size(); }
+
+    /// @brief Number of documents added to the table.
+    std::size_t documents() const { return this->n_documents; }
+
+    /// @brief Get unique words.
+    const std::vector<std::vector<T>>& get_words() const { return this->words; }
+
+    /// @brief Get unique words for modification; the table must be frozen.
+    std::vector<std::vector<T>>& get_words() {
+        if (!this->frozen)
+            throw std::logic_error(
+                "Words of a table can be modified only after it is frozen");
+        return this->words;
+    }
+
+    /// @brief Get counts of documents and occurrences for each word.
+    const std::vector<std::pair<std::size_t, std::size_t>>& get_counts() const {
+        return this->counts;
+    }
+};
+
+}  // namespace ubpe
+
+#endif  // WORD_TABLE_HPP
@@ -1,5 +1,5 @@
 __version__ = "0.3.0"
 
-from .libubpe import UBPE, UBPEClassic
+from .libubpe import UBPE, UBPEClassic, EncodeMode, UnknownPolicy, CancellationToken
 
-__all__ = ["UBPEClassic", "UBPE"]
+__all__ = ["UBPEClassic", "UBPE", "EncodeMode", "UnknownPolicy", "CancellationToken"]
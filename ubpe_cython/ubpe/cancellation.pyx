@@ -0,0 +1,81 @@
+# distutils: language = c++
+
+from cpython.exc cimport PyErr_CheckSignals
+from cython.operator cimport dereference as deref
+from libcpp cimport bool as cpp_bool
+from libcpp.memory cimport shared_ptr, make_shared
+
+from interface cimport CancellationToken as _CancellationToken
+
+
+cdef class CancellationToken:
+    """
+    Token to stop fitting of tokenizers early, e.g. from another thread or a signal handler.
+
+    A stopped fit makes tokens from the merges made until the stop, so the tokenizer is usable but has fewer tokens;
+    the first merge round is always made.
+    """
+    cdef shared_ptr[_CancellationToken] inner
+
+    def __cinit__(self):
+        self.inner = make_shared[_CancellationToken]()
+
+    def cancel(self):
+        """
+        Request to stop fitting at the next check between merge rounds.
+        """
+        deref(self.inner).cancel()
+
+    def reset(self):
+        """
+        Withdraw the request, so the token may be used for another fit.
+        """
+        deref(self.inner).reset()
+
+    def is_cancelled(self) -> bool:
+        return deref(self.inner).is_cancelled()
+
+
+cdef shared_ptr[_CancellationToken] _cancellation_token(CancellationToken token):
+    """
+    Convert an optional Python token to the shared C++ token.
+    """
+    if token is None:
+        return shared_ptr[_CancellationToken]()
+    return token.inner
+
+
+cdef class _Interrupts:
+    """
+    Exception raised by a signal handler, e.g. `KeyboardInterrupt`, while a tokenizer is fitted.
+
+    The exception stops fitting, and it is reraised on exit from the `with` block around the fit.
+    """
+    cdef object error
+
+    def __enter__(self):
+        self.error = None
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        error, self.error = self.error, None
+        if error is not None:
+            raise error
+        return False
+
+
+cdef cpp_bool _stop_on_interrupt(void* context) noexcept with gil:
+    """
+    Stop callback of the C++ fit: runs signal handlers of the interpreter, and lets other threads run, e.g. to cancel the fit.
+
+    Exceptions can not cross the C++ code, so they are stored in `context` and reraised after the fit.
+    """
+    cdef _Interrupts interrupts = <_Interrupts>context
+    with nogil:
+        pass
+    try:
+        PyErr_CheckSignals()
+    except BaseException as error:
+        interrupts.error = error
+        return True
+    return False
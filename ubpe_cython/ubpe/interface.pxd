@@ -1,9 +1,45 @@
-from libc.stdint cimport uint32_t, uint8_t
+from libc.stddef cimport size_t
+from libc.stdint cimport int64_t, uint32_t, uint8_t
+from libcpp cimport bool as cpp_bool
 from libcpp.map cimport map
+from libcpp.memory cimport shared_ptr
 from libcpp.optional cimport optional
 from libcpp.vector cimport vector
 from libcpp.pair cimport pair
 from libcpp.set cimport set as cpp_set
+from libcpp.string cimport string
+
+# Utils
+cdef extern from "utils.hpp" namespace "ubpe":
+    cdef enum class UnknownPolicy(uint8_t):
+        RAISE
+        SKIP
+        REPLACE
+
+    cdef enum class EncodeMode(uint8_t):
+        LATTICE
+        GREEDY
+        LATTICE_F32
+
+# Cancellation
+cdef extern from "cancellation.hpp" namespace "ubpe":
+    cdef cppclass CancellationToken:
+        CancellationToken()
+
+        void cancel()
+        void reset()
+        cpp_bool is_cancelled()
+
+# Merge history
+cdef extern from "merge_history.hpp" namespace "ubpe":
+    cdef struct Merge:
+        uint32_t first
+        uint32_t second
+        double weight
+
+    cdef cppclass MergeHistory:
+        uint32_t n_base_tokens
+        vector[Merge] merges
 
 # UBPE Classic
 cdef extern from "ubpe_classic.hpp" namespace "ubpe":
@@ -30,6 +66,8 @@ cdef extern from "ubpe_classic.hpp" namespace "ubpe":
             optional[map[DocType, uint32_t]] known_words,
             optional[cpp_set[TokenType]] break_tokens,
             optional[cpp_set[TokenType]] stop_tokens) except +
+        UbpeClassic(const char* data, size_t size) except +
+        UbpeClassic(const UbpeClassic[DocType, TokenType]& other) except +
 
         void fit(const vector[DocType]& corpus,
             uint32_t n_candidates,
@@ -40,8 +78,59 @@ cdef extern from "ubpe_classic.hpp" namespace "ubpe":
             uint32_t n_candidates,
             bint rearrange_tokens,
             bint quiet) except +
+        void fit(const vector[DocType]& corpus,
+            const vector[size_t]& weights,
+            uint32_t n_candidates,
+            bint rearrange_tokens,
+            uint8_t split_mode,
+            bint quiet) except +
+        void fit(const vector[vector[vector[uint32_t]]]& corpus,
+            const vector[size_t]& weights,
+            uint32_t n_candidates,
+            bint rearrange_tokens,
+            bint quiet) except +
+        vector[vector[vector[uint32_t]]] split_files[Reader](
+            const Reader& reader,
+            const vector[string]& paths,
+            bint by_lines,
+            uint8_t split_mode) except +
+
+        MergeHistory learn_merges(const vector[DocType]& corpus,
+            uint32_t n_candidates,
+            uint8_t split_mode,
+            bint quiet) except +
+        MergeHistory learn_merges(
+            const vector[vector[vector[uint32_t]]]& corpus,
+            uint32_t n_candidates,
+            bint quiet) except +
+        void fit_merges(const MergeHistory& history,
+            bint rearrange_tokens,
+            bint quiet) except +
+
+        void begin_fit() except +
+        void add_documents(const vector[DocType]& chunk,
+            uint8_t split_mode) except +
+        void add_documents(
+            const vector[vector[vector[uint32_t]]]& chunk) except +
+        void add_word_counts(
+            const vector[pair[DocType, pair[size_t, size_t]]]& words,
+            size_t n_documents,
+            uint8_t split_mode) except +
+        void add_word_counts(
+            const vector[pair[vector[vector[uint32_t]], pair[size_t, size_t]]]& words,
+            size_t n_documents) except +
+        void finish_fit(uint32_t n_candidates,
+            bint rearrange_tokens,
+            bint quiet) except +
 
         void rearrange_tokens(optional[uint32_t] n_tokens, bint quiet) except +
+        void truncate(uint32_t n_tokens,
+            bint rearrange_tokens,
+            bint quiet) except +
+
+        string serialize() except +
+
+        string embed(const string& name) except +
 
         vector[pair[vector[uint32_t], double]] encode(
             const DocType& doc,
@@ -50,9 +139,19 @@ cdef extern from "ubpe_classic.hpp" namespace "ubpe":
         vector[pair[vector[uint32_t], double]] encode(
             const vector[vector[uint32_t]]& doc,
             uint8_t top_n) except +
+        vector[vector[pair[vector[uint32_t], double]]] encode_batch(
+            const vector[DocType]& docs,
+            uint8_t top_n,
+            uint8_t split_mode) except +
+        vector[vector[pair[vector[uint32_t], double]]] encode_batch(
+            const vector[vector[vector[uint32_t]]]& docs,
+            uint8_t top_n) except +
 
         DocType decode(const vector[uint32_t]& tokens) except +
 
+        void set_unknown_policy(UnknownPolicy policy,
+            optional[TokenType] replacement) except +
+
         map[vector[uint32_t], uint32_t] getForwardMapper()
 
         map[uint32_t, vector[uint32_t]] getBackwardMapper()
@@ -71,9 +170,29 @@ cdef extern from "ubpe_classic.hpp" namespace "ubpe":
 
         optional[cpp_set[TokenType]] getStopTokens()
 
+        void set_max_token_length(optional[uint32_t] max_token_length) except +
+
+        optional[uint32_t] getMaxTokenLength()
+
+        void set_pair_memory_budget(optional[size_t] memory_budget,
+            const string& directory) except +
+
+        void set_cancellation_token(shared_ptr[CancellationToken] token)
+
+        void set_time_budget(optional[double] seconds) except +
+
+        void set_stop_callback(cpp_bool (*callback)(void*) noexcept,
+            void* context)
+
+        void warmup() except +
+
 
 # UBPE
 cdef extern from "ubpe.hpp" namespace "ubpe":
+    cdef struct BeamConfig:
+        size_t width
+        double margin
+
     cdef cppclass Ubpe[DocType, TokenType]:
         Ubpe(uint32_t n_tokens,
             map[TokenType, uint32_t] alphabet) except +
@@ -97,6 +216,8 @@ cdef extern from "ubpe.hpp" namespace "ubpe":
             optional[map[DocType, uint32_t]] known_words,
             optional[cpp_set[TokenType]] break_tokens,
             optional[cpp_set[TokenType]] stop_tokens) except +
+        Ubpe(const char* data, size_t size) except +
+        Ubpe(const Ubpe[DocType, TokenType]& other) except +
 
         void fit(const vector[DocType]& corpus,
             uint32_t n_candidates,
@@ -107,8 +228,59 @@ cdef extern from "ubpe.hpp" namespace "ubpe":
             uint32_t n_candidates,
             bint rearrange_tokens,
             bint quiet) except +
+        void fit(const vector[DocType]& corpus,
+            const vector[size_t]& weights,
+            uint32_t n_candidates,
+            bint rearrange_tokens,
+            uint8_t split_mode,
+            bint quiet) except +
+        void fit(const vector[vector[vector[uint32_t]]]& corpus,
+            const vector[size_t]& weights,
+            uint32_t n_candidates,
+            bint rearrange_tokens,
+            bint quiet) except +
+        vector[vector[vector[uint32_t]]] split_files[Reader](
+            const Reader& reader,
+            const vector[string]& paths,
+            bint by_lines,
+            uint8_t split_mode) except +
+
+        MergeHistory learn_merges(const vector[DocType]& corpus,
+            uint32_t n_candidates,
+            uint8_t split_mode,
+            bint quiet) except +
+        MergeHistory learn_merges(
+            const vector[vector[vector[uint32_t]]]& corpus,
+            uint32_t n_candidates,
+            bint quiet) except +
+        void fit_merges(const MergeHistory& history,
+            bint rearrange_tokens,
+            bint quiet) except +
+
+        void begin_fit() except +
+        void add_documents(const vector[DocType]& chunk,
+            uint8_t split_mode) except +
+        void add_documents(
+            const vector[vector[vector[uint32_t]]]& chunk) except +
+        void add_word_counts(
+            const vector[pair[DocType, pair[size_t, size_t]]]& words,
+            size_t n_documents,
+            uint8_t split_mode) except +
+        void add_word_counts(
+            const vector[pair[vector[vector[uint32_t]], pair[size_t, size_t]]]& words,
+            size_t n_documents) except +
+        void finish_fit(uint32_t n_candidates,
+            bint rearrange_tokens,
+            bint quiet) except +
 
         void rearrange_tokens(optional[uint32_t] n_tokens, bint quiet) except +
+        void truncate(uint32_t n_tokens,
+            bint rearrange_tokens,
+            bint quiet) except +
+
+        string serialize() except +
+
+        string embed(const string& name) except +
 
         vector[pair[vector[uint32_t], double]] encode(
             const DocType& doc,
@@ -117,9 +289,37 @@ cdef extern from "ubpe.hpp" namespace "ubpe":
         vector[pair[vector[uint32_t], double]] encode(
             const vector[vector[uint32_t]]& doc,
             uint8_t top_n) except +
+        vector[pair[vector[uint32_t], double]] encode(
+            const DocType& doc,
+            uint8_t top_n,
+            uint8_t split_mode,
+            EncodeMode encode_mode) except +
+        vector[pair[vector[uint32_t], double]] encode(
+            const vector[vector[uint32_t]]& doc,
+            uint8_t top_n,
+            EncodeMode encode_mode) except +
+        vector[vector[pair[vector[uint32_t], double]]] encode_batch(
+            const vector[DocType]& docs,
+            uint8_t top_n,
+            uint8_t split_mode) except +
+        vector[vector[pair[vector[uint32_t], double]]] encode_batch(
+            const vector[vector[vector[uint32_t]]]& docs,
+            uint8_t top_n) except +
+        pair[vector[pair[vector[uint32_t], double]], bint] encode_approx(
+            const DocType& doc,
+            uint8_t top_n,
+            const BeamConfig& beam,
+            uint8_t split_mode) except +
+        pair[vector[pair[vector[uint32_t], double]], bint] encode_approx(
+            const vector[vector[uint32_t]]& doc,
+            uint8_t top_n,
+            const BeamConfig& beam) except +
 
         DocType decode(const vector[uint32_t]& tokens) except +
 
+        void set_unknown_policy(UnknownPolicy policy,
+            optional[TokenType] replacement) except +
+
         map[vector[uint32_t], uint32_t] getForwardMapper()
 
         map[uint32_t, vector[uint32_t]] getBackwardMapper()
@@ -137,3 +337,58 @@ cdef extern from "ubpe.hpp" namespace "ubpe":
         optional[cpp_set[TokenType]] getBreakTokens()
 
         optional[cpp_set[TokenType]] getStopTokens()
+
+        void set_max_token_length(optional[uint32_t] max_token_length) except +
+
+        optional[uint32_t] getMaxTokenLength()
+
+        void set_pair_memory_budget(optional[size_t] memory_budget,
+            const string& directory) except +
+
+        void set_cancellation_token(shared_ptr[CancellationToken] token)
+
+        void set_time_budget(optional[double] seconds) except +
+
+        void set_stop_callback(cpp_bool (*callback)(void*) noexcept,
+            void* context)
+
+        void warmup() except +
+
+
+# Text codec
+cdef extern from "text_codec.hpp" namespace "ubpe":
+    cdef cppclass TextCodec:
+        TextCodec(map[uint32_t, int64_t] alphabet) except +
+        TextCodec(map[uint32_t, int64_t] alphabet,
+            map[int64_t, string] known_words) except +
+
+        vector[int64_t] encode(const string& text) except +
+        string decode(const vector[int64_t]& tokens) except +
+
+        void set_unknown_policy(UnknownPolicy policy,
+            optional[int64_t] replacement) except +
+
+        vector[vector[int64_t]] read_files(
+            const vector[string]& paths,
+            bint by_lines) except +
+
+
+# Split pipeline
+cdef extern from "splitter.hpp" namespace "ubpe":
+    cdef cppclass SplitPipeline[DocType, TokenType]:
+        SplitPipeline(map[TokenType, uint32_t] alphabet,
+            optional[map[DocType, uint32_t]] known_words,
+            optional[cpp_set[TokenType]] break_tokens,
+            optional[cpp_set[TokenType]] stop_tokens) except +
+
+        vector[vector[uint32_t]] operator()(
+            const DocType& doc,
+            uint8_t mode,
+            bint leave_separators) except +
+
+        void set_unknown_policy(UnknownPolicy policy,
+            optional[TokenType] replacement) except +
+
+        void set_regex_callback(
+            vector[pair[size_t, size_t]] (*callback)(const DocType&, void*) noexcept,
+            void* context)
@@ -1,12 +1,17 @@
 # distutils: language = c++
 
 include "splitter.pyx"
+include "text.pyx"
+include "cancellation.pyx"
 include "ubpe_classic.pyx"
 include "ubpe.pyx"
 
 __all__ = [
     "UBPEClassic",
-    "UBPE"
+    "UBPE",
+    "EncodeMode",
+    "UnknownPolicy",
+    "CancellationToken",
 ]
 
 UBPEClassic = {
@@ -1,12 +1,20 @@
 # distutils: language = c++
 
-include "ssstree.pyx"
-
 import re
-from enum import Flag
-from libcpp.vector cimport vector
-from libc.stdint cimport uint32_t
+from enum import Flag, IntEnum
+
+from cpython.unicode cimport PyUnicode_FromKindAndData, PyUnicode_4BYTE_KIND
+from cython.operator cimport dereference as deref
 from libc.stddef cimport size_t
+from libc.stdint cimport int64_t, uint32_t, uint8_t
+from libcpp.map cimport map
+from libcpp.memory cimport unique_ptr, make_unique
+from libcpp.optional cimport optional
+from libcpp.pair cimport pair
+from libcpp.set cimport set as cpp_set
+from libcpp.vector cimport vector
+
+from interface cimport SplitPipeline as _SplitPipeline, UnknownPolicy as _UnknownPolicy
 
 class SplitMode(Flag):
     """SplitMode enum
@@ -27,27 +35,73 @@ class SplitMode(Flag):
     STOP_TOKENS = 0b1000
     FULL = KNOWN_WORDS | BREAK_TOKENS | REGEX | STOP_TOKENS
 
-cdef list _split_part_by_tokens(str part, set tokens, bint leave_separators):
+
+class UnknownPolicy(IntEnum):
+    """UnknownPolicy enum
+
+    Options:
+        RAISE: Raise an exception on unknown letters and tokens.
+        SKIP: Drop unknown letters and tokens.
+        REPLACE: Replace unknown letters and tokens with a letter of the
+            alphabet.
     """
-    Split part by tokens.
+
+    RAISE = 0
+    SKIP = 1
+    REPLACE = 2
+
+
+cdef _UnknownPolicy _unknown_policy(uint8_t policy) except *:
     """
-    cdef list parts = []
-    cdef Py_ssize_t part_start = 0
-    cdef Py_ssize_t ti
-    cdef str token
-
-    for ti, token in enumerate(part):
-        if token not in tokens:
-            continue
-        if ti != part_start:
-            parts.append(part[part_start:ti])
-        if leave_separators:
-            parts.append(part[ti:ti+1])
-        part_start = ti + 1
-
-    if part_start < len(part):
-        parts.append(part[part_start:])
-    return parts
+    Convert an unknown policy to its C++ representation.
+    """
+    if policy == UnknownPolicy.RAISE:
+        return _UnknownPolicy.RAISE
+    if policy == UnknownPolicy.SKIP:
+        return _UnknownPolicy.SKIP
+    if policy == UnknownPolicy.REPLACE:
+        return _UnknownPolicy.REPLACE
+    raise ValueError(f"Unknown policy: {policy}")
+
+cdef vector[int64_t] _code_points(str text):
+    """
+    Convert a string to a sequence of its code points.
+    """
+    cdef vector[int64_t] code_points
+    cdef Py_UCS4 letter
+    code_points.reserve(len(text))
+    for letter in text:
+        code_points.push_back(letter)
+    return code_points
+
+cdef vector[pair[size_t, size_t]] _split_by_regex(const vector[int64_t]& part, void* context) noexcept:
+    """
+    Regex callback of the C++ split pipeline: finds bounds of regex matches in `part`.
+
+    Exceptions can not cross the C++ code, so they are stored in the pipeline and reraised after the split.
+    """
+    cdef SplitPipeline pipeline = <SplitPipeline>context
+    cdef vector[pair[size_t, size_t]] bounds
+    cdef vector[Py_UCS4] letters
+    cdef size_t i
+    cdef Py_ssize_t group
+
+    try:
+        letters.reserve(part.size())
+        for i in range(part.size()):
+            letters.push_back(<Py_UCS4>part[i])
+        text = PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, letters.data(), letters.size())
+        # `re.findall` returns the only group if the regex has one
+        group = 1 if pipeline._regex.groups == 1 else 0
+        for match in pipeline._regex.finditer(text):
+            begin, end = match.span(group)
+            if begin < 0:
+                begin = end = match.end()
+            bounds.push_back(pair[size_t, size_t](begin, end))
+    except BaseException as error:
+        pipeline._error = error
+        bounds.clear()
+    return bounds
 
 cdef class SplitPipeline:
     """SplitPipeline class"""
@@ -57,7 +111,8 @@ cdef class SplitPipeline:
     cdef set stop_tokens
     cdef str regex_str
     cdef object _regex
-    cdef SSSTree kw_ssstree
+    cdef object _error
+    cdef unique_ptr[_SplitPipeline[vector[int64_t], int64_t]] inner
 
     def __init__(
         self,
@@ -92,8 +147,9 @@ cdef class SplitPipeline:
             self.alphabet = alphabet
         else:
             raise Exception("`alphabet` must be either `list` | `set` | `str` | `dict`")
+        if not all(isinstance(token, str) and len(token) == 1 for token in self.alphabet):
+            raise TypeError("`alphabet` must consist of single characters")
 
-        self.kw_ssstree = None
         self.known_words = None
 
         if known_words is not None:
@@ -107,9 +163,6 @@ cdef class SplitPipeline:
                     raise TypeError(
                         "If `known_words` is provided, it must be a list of strings or a dict "
                     )
-                self.kw_ssstree = SSSTree()
-                for kw, val in self.known_words.items():
-                    self.kw_ssstree.add(kw, val)
             elif isinstance(known_words, dict):
                 key_types = set(type(key) for key in known_words)
                 if len(key_types) > 1:
@@ -130,9 +183,6 @@ cdef class SplitPipeline:
                         "`known_words` dict must have sequential integer keys"
                     )
                 self.known_words = known_words
-                self.kw_ssstree = SSSTree()
-                for kw, val in self.known_words.items():
-                    self.kw_ssstree.add(kw, val)
 
         self.break_tokens = None
         if break_tokens is not None and (
@@ -149,6 +199,7 @@ cdef class SplitPipeline:
         # Regex is always present
         self.regex_str = regex_str
         self._regex = re.compile(regex_str)
+        self._error = None
 
         self.stop_tokens = None
         if stop_tokens is not None and (
@@ -162,6 +213,51 @@ cdef class SplitPipeline:
             if len(self.stop_tokens) == 0:
                 self.stop_tokens = None
 
+        # the native pipeline works with code points
+        cdef map[int64_t, uint32_t] _alphabet
+        cdef optional[map[vector[int64_t], uint32_t]] _known_words
+        cdef optional[cpp_set[int64_t]] _break_tokens
+        cdef optional[cpp_set[int64_t]] _stop_tokens
+
+        for token, index in self.alphabet.items():
+            _alphabet[ord(token)] = index
+        if self.known_words is not None:
+            _known_words.emplace()
+            for word, index in self.known_words.items():
+                _known_words.value().insert((_code_points(word), index))
+        if self.break_tokens is not None:
+            _break_tokens.emplace()
+            for token in self.break_tokens:
+                _break_tokens.value().insert(ord(token))
+        if self.stop_tokens is not None:
+            _stop_tokens.emplace()
+            for token in self.stop_tokens:
+                _stop_tokens.value().insert(ord(token))
+
+        self.inner = make_unique[_SplitPipeline[vector[int64_t], int64_t]](
+            _alphabet, _known_words, _break_tokens, _stop_tokens
+        )
+        deref(self.inner).set_regex_callback(_split_by_regex, <void*>self)
+
+    def set_unknown_policy(
+        self,
+        uint8_t policy = UnknownPolicy.RAISE,
+        str replacement = None,
+    ):
+        """Set handling of letters that are not in the alphabet.
+
+        Args:
+            policy: The policy.
+            replacement: A letter of the alphabet that replaces unknown ones,
+                required for `UnknownPolicy.REPLACE`.
+        """
+        cdef optional[int64_t] _replacement
+        if replacement is not None:
+            if replacement not in self.alphabet:
+                raise ValueError("`replacement` must be a letter of the alphabet")
+            _replacement = optional[int64_t](<int64_t>ord(replacement))
+        deref(self.inner).set_unknown_policy(_unknown_policy(policy), _replacement)
+
     def __call__(
         self,
         str doc,
@@ -180,97 +276,14 @@ cdef class SplitPipeline:
             A list of parts.
         """
         cdef vector[vector[uint32_t]] parts
-        cdef Py_ssize_t si = 0
-        cdef Py_ssize_t part_start = 0
-        cdef Py_ssize_t len_doc = len(doc)
-        cdef list kw_candidates
-        cdef vector[uint32_t] current_ids
-        cdef str part
-        cdef str token
-        cdef list str_parts
-        cdef Py_ssize_t i
-
-        if SplitMode.KNOWN_WORDS in mode and self.kw_ssstree is not None:
-            while si < len_doc:
-                kw_candidates = self.kw_ssstree(doc, start=si, fast=True)
-                if len(kw_candidates) == 0:
-                    si += 1
-                    continue
-                if si != part_start:
-                    str_parts = self._split_part(doc[part_start:si], mode, leave_separators)
-                    for part in str_parts:
-                        current_ids = vector[uint32_t]()
-                        for token in part:
-                            current_ids.push_back(self.alphabet[token])
-                        parts.push_back(current_ids)
-                if leave_separators:
-                    current_ids = vector[uint32_t]()
-                    current_ids.push_back(kw_candidates[-1][1])
-                    parts.push_back(current_ids)
-                part_start = si + kw_candidates[-1][0]
-                si = part_start
-            if part_start < len_doc:
-                str_parts = self._split_part(doc[part_start:], mode, leave_separators)
-                for part in str_parts:
-                    current_ids = vector[uint32_t]()
-                    for token in part:
-                        current_ids.push_back(self.alphabet[token])
-                    parts.push_back(current_ids)
-        else:
-            str_parts = self._split_part(doc, mode, leave_separators)
-            for part in str_parts:
-                current_ids = vector[uint32_t]()
-                for token in part:
-                    current_ids.push_back(self.alphabet[token])
-                parts.push_back(current_ids)
-        return parts
+        cdef uint8_t _mode = mode.value if isinstance(mode, SplitMode) else mode
 
-    cpdef list _split_part(
-        self,
-        str part,
-        mode,
-        bint leave_separators,
-    ):
-        cdef list parts = [part]
-        cdef list splits
-        cdef str p
-
-        if SplitMode.BREAK_TOKENS in mode:
-            splits = []
-            for p in parts:
-                splits.extend(self._split_part_by_break_tokens(p, leave_separators))
-            parts = splits
-        if SplitMode.REGEX in mode:
-            splits = []
-            for p in parts:
-                splits.extend(self._split_part_by_regex(p))
-            parts = splits
-        if SplitMode.STOP_TOKENS in mode:
-            splits = []
-            for p in parts:
-                splits.extend(self._split_part_by_stop_tokens(p, leave_separators))
-            parts = splits
+        try:
+            parts = deref(self.inner)(_code_points(doc), _mode, leave_separators)
+        except IndexError:
+            raise KeyError("Unknown letter")
+        finally:
+            error, self._error = self._error, None
+        if error is not None:
+            raise error
         return parts
-
-    cpdef list _split_part_by_break_tokens(
-        self, str part, bint leave_separators
-    ):
-        return (
-            _split_part_by_tokens(part, self.break_tokens, leave_separators)
-            if self.break_tokens is not None
-            else [part]
-        )
-
-    cpdef list _split_part_by_regex(self, str part):
-        if self._regex is None:
-            return [part]
-        return self._regex.findall(part)
-
-    cpdef list _split_part_by_stop_tokens(
-        self, str part, bint leave_separators
-    ):
-        return (
-            _split_part_by_tokens(part, self.stop_tokens, leave_separators)
-            if self.stop_tokens is not None
-            else [part]
-        )
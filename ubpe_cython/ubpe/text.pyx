@@ -0,0 +1,22 @@
+# distutils: language = c++
+
+def _read_documents(paths, bint by_lines):
+    """
+    Read UTF-8 text files as a list of documents.
+
+    Each non-empty line is a document if `by_lines`, otherwise each file is a single document.
+    """
+    cdef list documents = []
+    cdef str line
+    for path in paths:
+        with open(path, encoding="utf-8-sig") as file:
+            if by_lines:
+                for line in file:
+                    line = line.rstrip("\r\n")
+                    if len(line) > 0:
+                        documents.append(line)
+            else:
+                line = file.read()
+                if len(line) > 0:
+                    documents.append(line)
+    return documents
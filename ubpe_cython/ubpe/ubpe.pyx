@@ -1,22 +1,64 @@
 # distutils: language = c++
 import json
+import os
+from enum import IntEnum
+from pickle import PickleBuffer
 
+from cpython.unicode cimport PyUnicode_DecodeUTF8
 from cython.operator cimport dereference as deref
+from libc.stddef cimport size_t
 from libc.stdint cimport int64_t, uint32_t, uint8_t
 from libcpp.map cimport map
 from libcpp.memory cimport unique_ptr, make_unique
 from libcpp.optional cimport optional, nullopt
+from libcpp.pair cimport pair
 from libcpp.set cimport set as cpp_set
 from libcpp.string cimport string
 from libcpp.vector cimport vector
 from libcpp cimport nullptr
 
 
-from interface cimport Ubpe
+from interface cimport BeamConfig, EncodeMode as _EncodeMode, MergeHistory, Ubpe, TextCodec, UnknownPolicy as _UnknownPolicy
+
+
+class EncodeMode(IntEnum):
+    """EncodeMode enum
+
+    Options:
+        LATTICE: Weighted search over all segmentations of words.
+        GREEDY: The longest token at each position; returns a single
+            encoding, but is much faster.
+        LATTICE_F32: LATTICE with weights in single precision, where near
+            ties are compared again in double precision; returns a single
+            encoding, that is several times faster, but may differ from
+            LATTICE where weights are equal up to rounding in double precision.
+    """
+
+    LATTICE = 0
+    GREEDY = 1
+    LATTICE_F32 = 2
+
+
+cdef _EncodeMode _encode_mode(uint8_t mode) except *:
+    """
+    Convert an encode mode to its C++ representation.
+    """
+    if mode == EncodeMode.LATTICE:
+        return _EncodeMode.LATTICE
+    if mode == EncodeMode.GREEDY:
+        return _EncodeMode.GREEDY
+    if mode == EncodeMode.LATTICE_F32:
+        return _EncodeMode.LATTICE_F32
+    raise ValueError(f"Unknown encode mode: {mode}")
 
 
 cdef class UbpeInt:
     cdef unique_ptr[Ubpe[vector[int64_t], int64_t]] inner
+    # signals caught while fitting
+    cdef _Interrupts interrupts
+
+    def __cinit__(self):
+        self.interrupts = _Interrupts()
 
     def __init__(
         self,
@@ -26,6 +68,7 @@ cdef class UbpeInt:
         known_words: list[list[int]] | dict[tuple[int, ...], int] | None = None,
         break_tokens: set[int] | list[int] | None = None,
         stop_tokens: set[int] | list[int] | None = None,
+        max_token_length: int | None = None,
     ):
         cdef uint32_t _n_tokens
 
@@ -80,6 +123,7 @@ cdef class UbpeInt:
             _known_words,
             _break_tokens, _stop_tokens,
         )
+        self.set_max_token_length(max_token_length)
 
     def dumps(self) -> str:
         """
@@ -109,6 +153,8 @@ cdef class UbpeInt:
             self.inverse_alphabet[token] for token in stop_tokens.value()
         ] if stop_tokens.has_value() and stop_tokens.value().size() > 0 else None
 
+        max_token_length = deref(self.inner).getMaxTokenLength()
+        inst["max_token_length"] = max_token_length.value() if max_token_length.has_value() else None
         inst["mapper"] = tokens_mapper
         inst["weights"] = tokens_weights
 
@@ -156,7 +202,7 @@ cdef class UbpeInt:
             for token in model["stop_tokens"]:
                 stop_tokens.value().insert(token)
 
-        cdef UbpeInt inst = cls()
+        cdef UbpeInt inst = cls.__new__(cls)
         inst.inner = make_unique[Ubpe[vector[int64_t], int64_t]](
             n_tokens,
             alphabet, inverse_alphabet,
@@ -164,10 +210,122 @@ cdef class UbpeInt:
             tokens_weights,
             known_words, break_tokens, stop_tokens
         )
+        inst.set_max_token_length(model.get("max_token_length", None))
         return inst
 
-    def fit(self, vector[vector[int64_t]] corpus, uint32_t n_candidates = 50, bint rearrange_tokens = True, uint8_t split_mode = 0b1111, bint quiet = False):
-        deref(self.inner).fit(corpus, n_candidates, rearrange_tokens, split_mode, quiet)
+    def embed(self, name: str) -> str:
+        """
+        Write the model as a C++ header with its tables in `constexpr` arrays, to compile it into a binary;
+        `ubpe::EmbeddedUbpe` encodes with `ubpe::embedded::<name>::model` of the header without loading.
+
+        Tokenizers with known words, break tokens, stop tokens or a regex pattern can not be embedded.
+        """
+        return deref(self.inner).embed(name.encode()).decode()
+
+    def __reduce_ex__(self, protocol):
+        """
+        Pickle the tokenizer with its compact binary representation.
+
+        With protocol 5 the representation is passed as a `PickleBuffer`, so it may be sent out-of-band.
+        """
+        data = deref(self.inner).serialize()
+        return type(self)._from_bytes, (PickleBuffer(data) if protocol >= 5 else data,)
+
+    @classmethod
+    def _from_bytes(cls, const unsigned char[::1] data):
+        """
+        Restore a pickled tokenizer from its binary representation.
+        """
+        cdef UbpeInt inst = cls.__new__(cls)
+        inst.inner = make_unique[Ubpe[vector[int64_t], int64_t]](
+            <const char*>&data[0] if data.shape[0] > 0 else NULL, data.shape[0]
+        )
+        return inst
+
+    def fit(self, vector[vector[int64_t]] corpus, uint32_t n_candidates = 50, bint rearrange_tokens = True, uint8_t split_mode = 0b1111, bint quiet = False, weights = None):
+        """
+        Fit the tokenizer with `corpus`.
+
+        `weights` are optional numbers of times to count each document, e.g. to oversample some sources
+        without copying their documents; documents with zero weight are ignored.
+        """
+        cdef vector[size_t] _weights
+        deref(self.inner).set_stop_callback(_stop_on_interrupt, <void*>self.interrupts)
+        with self.interrupts:
+            if weights is not None:
+                _weights = weights
+                deref(self.inner).fit(corpus, _weights, n_candidates, rearrange_tokens, split_mode, quiet)
+            else:
+                deref(self.inner).fit(corpus, n_candidates, rearrange_tokens, split_mode, quiet)
+
+    def fit_both(self, UbpeClassicInt classic, vector[vector[int64_t]] corpus, uint32_t n_candidates = 50, bint rearrange_tokens = True, uint8_t split_mode = 0b1111, bint quiet = False):
+        """
+        Fit this tokenizer and `classic` with `corpus`, making merges of pairs of tokens only once for both of them.
+
+        `classic` must be created with the same arguments as this tokenizer.
+        """
+        if deref(classic.inner).getAlphabet() != deref(self.inner).getAlphabet():
+            raise ValueError("`classic` must have the same alphabet")
+        cdef MergeHistory history
+        deref(self.inner).set_stop_callback(_stop_on_interrupt, <void*>self.interrupts)
+        with self.interrupts:
+            history = deref(self.inner).learn_merges(corpus, n_candidates, split_mode, quiet)
+            deref(self.inner).fit_merges(history, rearrange_tokens, quiet)
+            deref(classic.inner).fit_merges(history, rearrange_tokens, quiet)
+
+    def begin_fit(self):
+        """
+        Start fitting the tokenizer with a corpus passed in chunks to `add_documents`.
+        """
+        deref(self.inner).begin_fit()
+
+    def add_documents(self, vector[vector[int64_t]] chunk, uint8_t split_mode = 0b1111):
+        """
+        Add a chunk of documents to the corpus of the started fit.
+
+        Only unique words of the documents are kept, so chunks may be dropped after the call.
+        """
+        deref(self.inner).add_documents(chunk, split_mode)
+
+    def add_word_counts(self, dict counts, size_t n_documents, uint8_t split_mode = 0b1111):
+        """
+        Add unique words with precomputed counts to the corpus of the started fit.
+
+        `counts` maps words to pairs of the number of their occurrences and the number of documents they occur in,
+        and `n_documents` is the number of documents the counts were computed on.
+
+        Counts of pairs of tokens are the same as if the documents were added with `add_documents`: the number of
+        documents a pair occurs in is summed over words and capped by `n_documents`, so it is overcounted for documents
+        that contain the pair in several different words, see `finish_fit`.
+        """
+        cdef vector[pair[vector[int64_t], pair[size_t, size_t]]] _words = [
+            (word, tuple(word_counts)) for word, word_counts in counts.items()
+        ]
+        deref(self.inner).add_word_counts(_words, n_documents, split_mode)
+
+    def fit_word_counts(self, dict counts, size_t n_documents, uint32_t n_candidates = 50, bint rearrange_tokens = True, uint8_t split_mode = 0b1111, bint quiet = False):
+        """
+        Fit the tokenizer with unique words with precomputed counts, see `add_word_counts`.
+
+        Memory needed for fitting depends only on the number of unique words. Numbers of documents pairs of tokens occur
+        in are summed over words and capped by `n_documents`, so weights of tokens and the order of candidates with equal
+        counts may differ from those of `fit` on the documents the counts were computed on.
+        """
+        self.begin_fit()
+        self.add_word_counts(counts, n_documents, split_mode)
+        self.finish_fit(n_candidates, rearrange_tokens, quiet)
+
+    def finish_fit(self, uint32_t n_candidates = 50, bint rearrange_tokens = True, bint quiet = False):
+        """
+        Fit the tokenizer with the documents added since `begin_fit`.
+
+        Documents are not kept, so the number of documents a pair of tokens occurs in is summed over unique words and
+        capped by the number of documents. When a pair occurs in several different words of a document, weights of tokens
+        and the order of candidates with equal counts may differ from those of `fit` on the same corpus.
+        """
+        deref(self.inner).set_stop_callback(_stop_on_interrupt, <void*>self.interrupts)
+        with self.interrupts:
+            deref(self.inner).finish_fit(n_candidates, rearrange_tokens, quiet)
 
     def rearrange_tokens(self, *, n_tokens: int | None = None, quiet: bool = False):
         cdef optional[uint32_t] _n_tokens
@@ -177,23 +335,141 @@ cdef class UbpeInt:
             _n_tokens = optional[uint32_t](<uint32_t>n_tokens)
         deref(self.inner).rearrange_tokens(_n_tokens, quiet)
 
-    def encode(self, vector[int64_t] doc, uint8_t top_n = 1, uint8_t split_mode = 0b1111):
-        return deref(self.inner).encode(doc, top_n, split_mode)
+    def truncated(self, uint32_t n_tokens, bint rearrange_tokens = True, bint quiet = False):
+        """
+        Derive a tokenizer made by the first merges of the last fit, i.e. fitted with at most `n_tokens` tokens, which must not be more than the tokens of this tokenizer.
+
+        Merges are recorded only by fitting, so loaded tokenizers can not be truncated.
+        """
+        cdef UbpeInt inst = type(self).__new__(type(self))
+        inst.inner = make_unique[Ubpe[vector[int64_t], int64_t]](deref(self.inner))
+        deref(inst.inner).truncate(n_tokens, rearrange_tokens, quiet)
+        return inst
+
+    def encode(
+        self,
+        vector[int64_t] doc,
+        uint8_t top_n = 1,
+        uint8_t split_mode = 0b1111,
+        uint8_t encode_mode = EncodeMode.LATTICE,
+    ):
+        return deref(self.inner).encode(
+            doc, top_n, split_mode, _encode_mode(encode_mode))
+
+    def encode_batch(
+        self,
+        vector[vector[int64_t]] docs,
+        uint8_t top_n = 1,
+        uint8_t split_mode = 0b1111,
+    ):
+        """
+        Encode documents, reusing encodings of common word endings between
+        them. The result is the same as of `encode` for each document.
+        """
+        return deref(self.inner).encode_batch(docs, top_n, split_mode)
+
+    def encode_approx(
+        self,
+        vector[int64_t] doc,
+        uint8_t top_n = 1,
+        size_t beam_width = 4,
+        double margin = float("inf"),
+        uint8_t split_mode = 0b1111,
+    ):
+        """
+        Encode with pruning of candidates, that is faster for large `top_n`.
+        Returns the candidates and a flag if they are guaranteed to be the same
+        as `encode` returns.
+        """
+        cdef BeamConfig beam = BeamConfig(width=beam_width, margin=margin)
+        return deref(self.inner).encode_approx(doc, top_n, beam, split_mode)
 
     def decode(self, vector[uint32_t] tokens):
         return deref(self.inner).decode(tokens)
 
+    def set_fit_limits(self, time_budget: float | None = None, CancellationToken cancellation_token = None):
+        """
+        Limit the following fits: a fit stops after `time_budget` seconds of merge rounds, or when `cancellation_token` is cancelled.
+
+        A stopped fit makes tokens from the merges made until the stop, so the tokenizer is usable but has fewer tokens;
+        the first merge round is always made. Fits also stop on signals, e.g. Ctrl-C; then the exception of the signal handler is raised after the tokenizer is built.
+        The limits are not saved with the tokenizer.
+        """
+        cdef optional[double] _time_budget
+        if time_budget is not None:
+            _time_budget = optional[double](<double>time_budget)
+        deref(self.inner).set_time_budget(_time_budget)
+        deref(self.inner).set_cancellation_token(_cancellation_token(cancellation_token))
+
+    def set_pair_memory_budget(self, memory_budget: int | None = None, directory: str | None = None):
+        """
+        Limit memory in bytes for counts of pairs of tokens while fitting; counts beyond the budget are spilled to files in `directory`, or in the temporary directory of the system.
+
+        Fitting gives the same tokens as without the limit, but slower. If `memory_budget` is `None`, all counts are kept in memory.
+        The budget is not saved with the tokenizer.
+        """
+        cdef optional[size_t] _memory_budget
+        cdef size_t _budget
+        if memory_budget is not None:
+            _budget = memory_budget
+            _memory_budget = optional[size_t](_budget)
+        deref(self.inner).set_pair_memory_budget(
+            _memory_budget, os.fsencode(directory) if directory is not None else b""
+        )
+
+    def set_max_token_length(self, max_token_length: int | None = None):
+        """
+        Limit the number of symbols of the alphabet and known words that tokens made by the following fits may expand to.
+
+        The limit bounds the depth of the search for tokens when encoding, and it is saved with the tokenizer.
+        If `max_token_length` is `None`, tokens are not limited.
+        """
+        cdef optional[uint32_t] _max_token_length
+        cdef uint32_t _length
+        if max_token_length is not None:
+            _length = max_token_length
+            _max_token_length = optional[uint32_t](_length)
+        deref(self.inner).set_max_token_length(_max_token_length)
+
+    def set_unknown_policy(self, uint8_t policy = UnknownPolicy.RAISE, replacement: int | None = None):
+        """
+        Set handling of symbols that are not in the alphabet when encoding,
+        and of unknown tokens when decoding.
+
+        `replacement` is a symbol of the alphabet, required for `UnknownPolicy.REPLACE`.
+        The policy is not saved with the tokenizer.
+        """
+        cdef optional[int64_t] _replacement
+        if replacement is not None:
+            _replacement = optional[int64_t](<int64_t>replacement)
+        deref(self.inner).set_unknown_policy(_unknown_policy(policy), _replacement)
+
+    def warmup(self):
+        """
+        Build structures for encoding and decoding that loaded tokenizers otherwise build on first use,
+        e.g. for predictable latency of the first calls.
+        """
+        deref(self.inner).warmup()
+
 
 cdef class UbpeChar:
     cdef unique_ptr[Ubpe[vector[int64_t], int64_t]] inner
+    # signals caught while fitting
+    cdef _Interrupts interrupts
 
     cdef readonly dict[str, int] alphabet
     cdef readonly dict[int, str] inverse_alphabet
     cdef readonly dict[int64_t, str] inverse_known_words
 
+    # native mapping between letters and tokens
+    cdef unique_ptr[TextCodec] codec
+
     # this can be None
     cdef readonly SplitPipeline split_pipeline
 
+    def __cinit__(self):
+        self.interrupts = _Interrupts()
+
     def __init__(
         self,
         *,
@@ -203,6 +479,7 @@ cdef class UbpeChar:
         break_tokens: set[str] | list[str] | None = None,
         regex_str: str | None = None,
         stop_tokens: set[str] | list[str] | None = None,
+        max_token_length: int | None = None,
     ):
         # ensure that `alphabet` is a dict
         if alphabet is None:
@@ -223,9 +500,10 @@ cdef class UbpeChar:
         cdef map[int64_t, uint32_t] _alphabet
 
         if regex_str is not None:
-            # Python's and C++'s strings differ a lot,
+            # Python's and C++'s regexes differ a lot,
             # so if regex present in the split pipeline,
-            # split is done in Python
+            # it is matched in Python, while the rest
+            # of the split is done natively on code points
             self.split_pipeline = SplitPipeline(alphabet,
                 known_words=known_words,
                 break_tokens=break_tokens,
@@ -249,6 +527,8 @@ cdef class UbpeChar:
                 _n_tokens,
                 _alphabet,
             )
+            self.set_max_token_length(max_token_length)
+            self._init_codec()
             return
 
         cdef optional[map[vector[int64_t], uint32_t]] _known_words
@@ -288,6 +568,27 @@ cdef class UbpeChar:
             _known_words,
             _break_tokens, _stop_tokens,
         )
+        self.set_max_token_length(max_token_length)
+        self._init_codec()
+
+    cdef void _init_codec(self):
+        """
+        Build the native codec between letters and tokens.
+        """
+        cdef map[uint32_t, int64_t] code_points
+        cdef map[int64_t, string] known_words
+        for letter, token in self.alphabet.items():
+            code_points[ord(letter)] = token
+        if self.inverse_known_words is not None:
+            for token, word in self.inverse_known_words.items():
+                known_words[token] = word.encode("utf-8", "surrogatepass")
+        self.codec = make_unique[TextCodec](code_points, known_words)
+
+    cdef vector[int64_t] _tokens(self, str doc) except *:
+        """
+        Convert letters of a document to tokens with the native codec.
+        """
+        return deref(self.codec).encode(doc.encode("utf-8", "surrogatepass"))
 
     def dumps(self) -> str:
         """
@@ -321,6 +622,8 @@ cdef class UbpeChar:
                 self.inverse_alphabet[token] for token in stop_tokens.value()
             ] if stop_tokens.has_value() and stop_tokens.value().size() > 0 else None
 
+        max_token_length = deref(self.inner).getMaxTokenLength()
+        inst["max_token_length"] = max_token_length.value() if max_token_length.has_value() else None
         inst["mapper"] = tokens_mapper
         inst["weights"] = tokens_weights
 
@@ -381,6 +684,7 @@ cdef class UbpeChar:
                 tokens_forward_mapping, tokens_backward_mapping,
                 tokens_weights
             )
+            inst.set_max_token_length(model.get("max_token_length", None))
             return inst
 
         cdef optional[map[vector[int64_t], uint32_t]] known_words
@@ -410,28 +714,203 @@ cdef class UbpeChar:
             known_words,
             break_tokens, stop_tokens
         )
+        inst.set_max_token_length(model.get("max_token_length", None))
         return inst
 
-    def fit(self, list[str] corpus, uint32_t n_candidates = 50, bint rearrange_tokens = True, uint8_t split_mode = 0b1111, bint quiet = False):
+    cdef dict _config(self):
+        """
+        Arguments of the constructor that restore Python-side state of the tokenizer.
+        """
+        config = {
+            "alphabet": self.alphabet,
+            "known_words": {
+                word: token for token, word in self.inverse_known_words.items()
+            } if self.inverse_known_words else None,
+        }
         if self.split_pipeline is not None:
-            deref(self.inner).fit([
+            config["break_tokens"] = self.split_pipeline.break_tokens
+            config["regex_str"] = self.split_pipeline.regex_str
+            config["stop_tokens"] = self.split_pipeline.stop_tokens
+        return config
+
+    def embed(self, name: str) -> str:
+        """
+        Write the model as a C++ header with its tables in `constexpr` arrays, to compile it into a binary;
+        `ubpe::EmbeddedUbpe` encodes with `ubpe::embedded::<name>::model` of the header without loading.
+
+        Symbols of the embedded model are the tokens of letters of `alphabet`.
+        Tokenizers with known words, break tokens, stop tokens or a regex pattern can not be embedded.
+        """
+        return deref(self.inner).embed(name.encode()).decode()
+
+    def __reduce_ex__(self, protocol):
+        """
+        Pickle the tokenizer with its compact binary representation.
+
+        With protocol 5 the representation is passed as a `PickleBuffer`, so it may be sent out-of-band.
+        """
+        data = deref(self.inner).serialize()
+        return type(self)._from_bytes, (self._config(), PickleBuffer(data) if protocol >= 5 else data)
+
+    @classmethod
+    def _from_bytes(cls, dict config, const unsigned char[::1] data):
+        """
+        Restore a pickled tokenizer from its binary representation.
+        """
+        cdef UbpeChar inst = cls(**config)
+        inst.inner = make_unique[Ubpe[vector[int64_t], int64_t]](
+            <const char*>&data[0] if data.shape[0] > 0 else NULL, data.shape[0]
+        )
+        return inst
+
+    def fit(self, list[str] corpus, uint32_t n_candidates = 50, bint rearrange_tokens = True, uint8_t split_mode = 0b1111, bint quiet = False, weights = None):
+        """
+        Fit the tokenizer with `corpus`.
+
+        `weights` are optional numbers of times to count each document, e.g. to oversample some sources
+        without copying their documents; documents with zero weight are ignored.
+        """
+        cdef vector[size_t] _weights
+        if weights is not None:
+            _weights = weights
+
+        cdef vector[vector[vector[uint32_t]]] _parts
+        cdef vector[vector[int64_t]] _corpus
+        deref(self.inner).set_stop_callback(_stop_on_interrupt, <void*>self.interrupts)
+        if self.split_pipeline is not None:
+            _parts = [
                 self.split_pipeline(doc, leave_separators=False)
                 for doc in corpus
-            ], n_candidates, rearrange_tokens, quiet)
+            ]
+            with self.interrupts:
+                if weights is not None:
+                    deref(self.inner).fit(_parts, _weights, n_candidates, rearrange_tokens, quiet)
+                else:
+                    deref(self.inner).fit(_parts, n_candidates, rearrange_tokens, quiet)
             return
 
+        _corpus = [self._tokens(doc) for doc in corpus]
+        with self.interrupts:
+            if weights is not None:
+                deref(self.inner).fit(_corpus, _weights, n_candidates, rearrange_tokens, split_mode, quiet)
+            else:
+                deref(self.inner).fit(_corpus, n_candidates, rearrange_tokens, split_mode, quiet)
+
+    def fit_both(self, UbpeClassicChar classic, list[str] corpus, uint32_t n_candidates = 50, bint rearrange_tokens = True, uint8_t split_mode = 0b1111, bint quiet = False):
+        """
+        Fit this tokenizer and `classic` with `corpus`, making merges of pairs of tokens only once for both of them.
+
+        `classic` must be created with the same arguments as this tokenizer.
+        """
+        if classic._config() != self._config():
+            raise ValueError("`classic` must be created with the same arguments")
+
+        cdef MergeHistory history
+        cdef vector[vector[vector[uint32_t]]] _parts
         cdef vector[vector[int64_t]] _corpus
-        try:
-            _corpus = [
-                [
-                    self.alphabet[letter]
-                    for letter in doc
+        deref(self.inner).set_stop_callback(_stop_on_interrupt, <void*>self.interrupts)
+        with self.interrupts:
+            if self.split_pipeline is not None:
+                _parts = [
+                    self.split_pipeline(doc, leave_separators=False)
+                    for doc in corpus
                 ]
-                for doc in corpus
-            ]
-        except:
-            raise Exception("Unknown letter")
-        deref(self.inner).fit(_corpus, n_candidates, rearrange_tokens, split_mode, quiet)
+                history = deref(self.inner).learn_merges(_parts, n_candidates, quiet)
+            else:
+                _corpus = [self._tokens(doc) for doc in corpus]
+                history = deref(self.inner).learn_merges(_corpus, n_candidates, split_mode, quiet)
+            deref(self.inner).fit_merges(history, rearrange_tokens, quiet)
+            deref(classic.inner).fit_merges(history, rearrange_tokens, quiet)
+
+    def fit_from_files(self, paths, uint32_t n_candidates = 50, bint rearrange_tokens = True, uint8_t split_mode = 0b1111, bint quiet = False, bint by_lines = True):
+        """
+        Fit the tokenizer with UTF-8 text files.
+
+        Files are read, converted to tokens and split into words on the C++ side, without building Python strings;
+        with `by_lines` each line is split as soon as it is read, so whole files are not kept in memory.
+        Each non-empty line is a document if `by_lines`, otherwise each file is a single document.
+        """
+        if isinstance(paths, (str, bytes, os.PathLike)):
+            paths = [paths]
+
+        if self.split_pipeline is not None:
+            # regex split is done in Python, so the files are read there as well
+            self.fit(_read_documents(paths, by_lines), n_candidates, rearrange_tokens, split_mode, quiet)
+            return
+
+        cdef vector[string] _paths = [os.fsencode(path) for path in paths]
+        deref(self.inner).set_stop_callback(_stop_on_interrupt, <void*>self.interrupts)
+        with self.interrupts:
+            deref(self.inner).fit(deref(self.inner).split_files[TextCodec](deref(self.codec), _paths, by_lines, split_mode), n_candidates, rearrange_tokens, quiet)
+
+    def begin_fit(self):
+        """
+        Start fitting the tokenizer with a corpus passed in chunks to `add_documents`.
+        """
+        deref(self.inner).begin_fit()
+
+    def add_documents(self, list[str] chunk, uint8_t split_mode = 0b1111):
+        """
+        Add a chunk of documents to the corpus of the started fit.
+
+        Only unique words of the documents are kept, so chunks may be dropped after the call.
+        """
+        if self.split_pipeline is not None:
+            deref(self.inner).add_documents([
+                self.split_pipeline(doc, leave_separators=False)
+                for doc in chunk
+            ])
+            return
+
+        cdef vector[vector[int64_t]] _chunk = [self._tokens(doc) for doc in chunk]
+        deref(self.inner).add_documents(_chunk, split_mode)
+
+    def add_word_counts(self, dict counts, size_t n_documents, uint8_t split_mode = 0b1111):
+        """
+        Add unique words with precomputed counts to the corpus of the started fit.
+
+        `counts` maps words to pairs of the number of their occurrences and the number of documents they occur in,
+        and `n_documents` is the number of documents the counts were computed on.
+
+        Counts of pairs of tokens are the same as if the documents were added with `add_documents`: the number of
+        documents a pair occurs in is summed over words and capped by `n_documents`, so it is overcounted for documents
+        that contain the pair in several different words, see `finish_fit`.
+        """
+        if self.split_pipeline is not None:
+            deref(self.inner).add_word_counts([
+                (self.split_pipeline(word, leave_separators=False), tuple(word_counts))
+                for word, word_counts in counts.items()
+            ], n_documents)
+            return
+
+        cdef vector[pair[vector[int64_t], pair[size_t, size_t]]] _words = [
+            (self._tokens(word), tuple(word_counts)) for word, word_counts in counts.items()
+        ]
+        deref(self.inner).add_word_counts(_words, n_documents, split_mode)
+
+    def fit_word_counts(self, dict counts, size_t n_documents, uint32_t n_candidates = 50, bint rearrange_tokens = True, uint8_t split_mode = 0b1111, bint quiet = False):
+        """
+        Fit the tokenizer with unique words with precomputed counts, see `add_word_counts`.
+
+        Memory needed for fitting depends only on the number of unique words. Numbers of documents pairs of tokens occur
+        in are summed over words and capped by `n_documents`, so weights of tokens and the order of candidates with equal
+        counts may differ from those of `fit` on the documents the counts were computed on.
+        """
+        self.begin_fit()
+        self.add_word_counts(counts, n_documents, split_mode)
+        self.finish_fit(n_candidates, rearrange_tokens, quiet)
+
+    def finish_fit(self, uint32_t n_candidates = 50, bint rearrange_tokens = True, bint quiet = False):
+        """
+        Fit the tokenizer with the documents added since `begin_fit`.
+
+        Documents are not kept, so the number of documents a pair of tokens occurs in is summed over unique words and
+        capped by the number of documents. When a pair occurs in several different words of a document, weights of tokens
+        and the order of candidates with equal counts may differ from those of `fit` on the same corpus.
+        """
+        deref(self.inner).set_stop_callback(_stop_on_interrupt, <void*>self.interrupts)
+        with self.interrupts:
+            deref(self.inner).finish_fit(n_candidates, rearrange_tokens, quiet)
 
     def rearrange_tokens(self, *, n_tokens: int | None = None, quiet: bool = False):
         cdef optional[uint32_t] _n_tokens
@@ -441,24 +920,146 @@ cdef class UbpeChar:
             _n_tokens = optional[uint32_t](<uint32_t>n_tokens)
         deref(self.inner).rearrange_tokens(_n_tokens, quiet)
 
+    def truncated(self, uint32_t n_tokens, bint rearrange_tokens = True, bint quiet = False):
+        """
+        Derive a tokenizer made by the first merges of the last fit, i.e. fitted with at most `n_tokens` tokens, which must not be more than the tokens of this tokenizer.
+
+        Merges are recorded only by fitting, so loaded tokenizers can not be truncated.
+        """
+        cdef UbpeChar inst = type(self)(**self._config())
+        inst.inner = make_unique[Ubpe[vector[int64_t], int64_t]](deref(self.inner))
+        deref(inst.inner).truncate(n_tokens, rearrange_tokens, quiet)
+        return inst
+
 
-    def encode(self, str doc, uint8_t top_n = 1, uint8_t split_mode = 0b1111):
+    def encode(
+        self,
+        str doc,
+        uint8_t top_n = 1,
+        uint8_t split_mode = 0b1111,
+        uint8_t encode_mode = EncodeMode.LATTICE,
+    ):
+        cdef _EncodeMode _mode = _encode_mode(encode_mode)
+        cdef vector[vector[uint32_t]] parts
+        if self.split_pipeline is not None:
+            parts = self.split_pipeline(doc, mode=SplitMode(split_mode))
+            return deref(self.inner).encode(parts, top_n, _mode)
+
+        cdef vector[int64_t] _doc = self._tokens(doc)
+        return deref(self.inner).encode(_doc, top_n, split_mode, _mode)
+
+    def encode_batch(
+        self,
+        list docs,
+        uint8_t top_n = 1,
+        uint8_t split_mode = 0b1111,
+    ):
+        """
+        Encode documents, reusing encodings of common word endings between
+        them. The result is the same as of `encode` for each document.
+        """
+        cdef vector[vector[vector[uint32_t]]] parts
         if self.split_pipeline is not None:
-            return deref(self.inner).encode(self.split_pipeline(doc, mode=SplitMode(split_mode)), top_n)
+            parts = [
+                self.split_pipeline(doc, mode=SplitMode(split_mode))
+                for doc in docs
+            ]
+            return deref(self.inner).encode_batch(parts, top_n)
 
-        cdef vector[int64_t] _doc
-        try:
-            _doc = [self.alphabet[letter] for letter in doc]
-        except:
-            raise Exception("Unknown letter")
-        return deref(self.inner).encode(_doc, top_n, split_mode)
+        cdef vector[vector[int64_t]] _docs = [self._tokens(doc) for doc in docs]
+        return deref(self.inner).encode_batch(_docs, top_n, split_mode)
+
+    def encode_approx(
+        self,
+        str doc,
+        uint8_t top_n = 1,
+        size_t beam_width = 4,
+        double margin = float("inf"),
+        uint8_t split_mode = 0b1111,
+    ):
+        """
+        Encode with pruning of candidates, that is faster for large `top_n`.
+        Returns the candidates and a flag if they are guaranteed to be the same
+        as `encode` returns.
+        """
+        cdef BeamConfig beam = BeamConfig(width=beam_width, margin=margin)
+        if self.split_pipeline is not None:
+            return deref(self.inner).encode_approx(
+                self.split_pipeline(doc, mode=SplitMode(split_mode)), top_n, beam)
+
+        cdef vector[int64_t] _doc = self._tokens(doc)
+        return deref(self.inner).encode_approx(_doc, top_n, beam, split_mode)
 
     def decode(self, vector[uint32_t] tokens):
-        cdef vector[int64_t] doc
-        doc = deref(self.inner).decode(tokens)
-        return "".join(
-            self.inverse_alphabet[token]
-            if token in self.inverse_alphabet else
-            self.inverse_known_words[token]
-            for token in doc
+        cdef string text = deref(self.codec).decode(deref(self.inner).decode(tokens))
+        return PyUnicode_DecodeUTF8(text.data(), text.size(), "surrogatepass")
+
+    def set_fit_limits(self, time_budget: float | None = None, CancellationToken cancellation_token = None):
+        """
+        Limit the following fits: a fit stops after `time_budget` seconds of merge rounds, or when `cancellation_token` is cancelled.
+
+        A stopped fit makes tokens from the merges made until the stop, so the tokenizer is usable but has fewer tokens;
+        the first merge round is always made. Fits also stop on signals, e.g. Ctrl-C; then the exception of the signal handler is raised after the tokenizer is built.
+        The limits are not saved with the tokenizer.
+        """
+        cdef optional[double] _time_budget
+        if time_budget is not None:
+            _time_budget = optional[double](<double>time_budget)
+        deref(self.inner).set_time_budget(_time_budget)
+        deref(self.inner).set_cancellation_token(_cancellation_token(cancellation_token))
+
+    def set_pair_memory_budget(self, memory_budget: int | None = None, directory: str | None = None):
+        """
+        Limit memory in bytes for counts of pairs of tokens while fitting; counts beyond the budget are spilled to files in `directory`, or in the temporary directory of the system.
+
+        Fitting gives the same tokens as without the limit, but slower. If `memory_budget` is `None`, all counts are kept in memory.
+        The budget is not saved with the tokenizer.
+        """
+        cdef optional[size_t] _memory_budget
+        cdef size_t _budget
+        if memory_budget is not None:
+            _budget = memory_budget
+            _memory_budget = optional[size_t](_budget)
+        deref(self.inner).set_pair_memory_budget(
+            _memory_budget, os.fsencode(directory) if directory is not None else b""
         )
+
+    def set_max_token_length(self, max_token_length: int | None = None):
+        """
+        Limit the number of symbols of the alphabet and known words that tokens made by the following fits may expand to.
+
+        The limit bounds the depth of the search for tokens when encoding, and it is saved with the tokenizer.
+        If `max_token_length` is `None`, tokens are not limited.
+        """
+        cdef optional[uint32_t] _max_token_length
+        cdef uint32_t _length
+        if max_token_length is not None:
+            _length = max_token_length
+            _max_token_length = optional[uint32_t](_length)
+        deref(self.inner).set_max_token_length(_max_token_length)
+
+    def set_unknown_policy(self, uint8_t policy = UnknownPolicy.RAISE, str replacement = None):
+        """
+        Set handling of letters that are not in the alphabet when encoding,
+        and of unknown tokens when decoding.
+
+        `replacement` is a letter of the alphabet, required for `UnknownPolicy.REPLACE`.
+        The policy is not saved with the tokenizer.
+        """
+        cdef _UnknownPolicy _policy = _unknown_policy(policy)
+        cdef optional[int64_t] _replacement
+        if replacement is not None:
+            if replacement not in self.alphabet:
+                raise ValueError("`replacement` must be a letter of the alphabet")
+            _replacement = optional[int64_t](<int64_t>self.alphabet[replacement])
+        deref(self.inner).set_unknown_policy(_policy, _replacement)
+        deref(self.codec).set_unknown_policy(_policy, _replacement)
+        if self.split_pipeline is not None:
+            self.split_pipeline.set_unknown_policy(policy, replacement)
+
+    def warmup(self):
+        """
+        Build structures for encoding and decoding that loaded tokenizers otherwise build on first use,
+        e.g. for predictable latency of the first calls.
+        """
+        deref(self.inner).warmup()